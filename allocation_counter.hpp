@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdlib>
+#include <new>
+
+#include "stats.hpp"
+
+// replaces the global operator new to count allocations into stats.
+// replacements cannot be inline, so include this from the translation
+// unit with main only. the counters are shared, so they are only touched
+// while stats::counting_allocations(), otherwise an allocation costs a
+// relaxed load more.
+
+void* operator new (std::size_t size)
+{
+  if (stats::counting_allocations())
+  {
+    stats::allocations.fetch_add (1, std::memory_order_relaxed);
+    stats::allocated_bytes.fetch_add (size, std::memory_order_relaxed);
+  }
+  // like the standard one, give the new handler a chance to free memory
+  // until it gives up
+  for (;;)
+  {
+    if (void* p = std::malloc (size ? size : 1))
+    {
+      return p;
+    }
+    const std::new_handler handler (std::get_new_handler());
+    if (!handler)
+    {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+__attribute__ ((noinline)) void operator delete (void* p) noexcept
+{
+  std::free (p);
+}
+__attribute__ ((noinline)) void operator delete (void* p, std::size_t) noexcept
+{
+  std::free (p);
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "package_view.hpp"
+#include "tree_output.hpp"
+
+// a single file holding what the 'by id' tree holds, with a table of
+// contents up front so it can be mapped and used in place:
+//   archive_header
+//   archive_package[package_count], sorted by id
+//   archive_member[member_count], grouped by package, sorted by sequence
+//   data: names and contents, referenced by offset into this block
+struct archive_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t package_count;
+  uint32_t member_count;
+  uint64_t data_size;
+};
+static_assert (sizeof (archive_header) == 0x18, "size of archive_header");
+
+struct archive_package
+{
+  int32_t id;
+  uint32_t first_member;
+  uint32_t member_count;
+  uint32_t name_size;
+  uint64_t name_offset;
+};
+static_assert (sizeof (archive_package) == 0x18, "size of archive_package");
+
+struct archive_member
+{
+  int32_t sequence;
+  int32_t include_id;
+  uint32_t name_size;
+  uint32_t padding;
+  uint64_t name_offset;
+  uint64_t content_offset;
+  uint64_t content_size;
+};
+static_assert (sizeof (archive_member) == 0x28, "size of archive_member");
+
+constexpr uint32_t const archive_magic = 0x52415353; // 'SSAR'
+constexpr uint32_t const archive_version = 1;
+
+// returns whether the file changed. packages are sorted on the way, the
+// given ones are left alone.
+inline bool write_archive (const boost::filesystem::path filename, std::vector<package_view> packages)
+{
+  std::sort ( packages.begin(), packages.end()
+            , [] (package_view const& lhs, package_view const& rhs) { return lhs.id < rhs.id; }
+            );
+
+  std::vector<archive_package> toc_packages;
+  std::vector<archive_member> toc_members;
+  content_pieces data;
+  uint64_t data_size (0);
+  const auto append
+    ( [&] (std::string_view piece)
+      {
+        data.push_back (piece);
+        data_size += piece.size();
+      }
+    );
+
+  for (package_view& package : packages)
+  {
+    std::stable_sort ( package.members.begin(), package.members.end()
+                     , [] (member_view const& lhs, member_view const& rhs) { return lhs.sequence < rhs.sequence; }
+                     );
+
+    archive_package toc_package;
+    toc_package.id = package.id;
+    toc_package.first_member = toc_members.size();
+    toc_package.member_count = package.members.size();
+    toc_package.name_size = package.name.size();
+    toc_package.name_offset = data_size;
+    append (package.name);
+    toc_packages.push_back (toc_package);
+
+    for (member_view const& member : package.members)
+    {
+      archive_member toc_member;
+      toc_member.sequence = member.sequence;
+      toc_member.include_id = member.include_id;
+      toc_member.name_size = member.name.size();
+      toc_member.padding = 0;
+      toc_member.name_offset = data_size;
+      append (member.name);
+      toc_member.content_offset = data_size;
+      for (std::string_view piece : member.content)
+      {
+        append (piece);
+      }
+      toc_member.content_size = data_size - toc_member.content_offset;
+      toc_members.push_back (toc_member);
+    }
+  }
+
+  archive_header header;
+  header.magic = archive_magic;
+  header.version = archive_version;
+  header.package_count = toc_packages.size();
+  header.member_count = toc_members.size();
+  header.data_size = data_size;
+
+  content_pieces content;
+  content.reserve (data.size() + 3);
+  content.emplace_back (reinterpret_cast<const char*> (&header), sizeof (header));
+  content.emplace_back ( reinterpret_cast<const char*> (toc_packages.data())
+                       , toc_packages.size() * sizeof (archive_package)
+                       );
+  content.emplace_back ( reinterpret_cast<const char*> (toc_members.data())
+                       , toc_members.size() * sizeof (archive_member)
+                       );
+  content.insert (content.end(), data.begin(), data.end());
+  return write_file_if_changed (filename, content);
+}
+
+// views of all packages in an archive in memory, usually a mapped_file
+inline std::vector<package_view> read_archive (const char* file, std::size_t size)
+{
+  if (size < sizeof (archive_header)) throw std::invalid_argument ("archive too small");
+  archive_header header;
+  std::memcpy (&header, file, sizeof (header));
+  if (header.magic != archive_magic) throw std::invalid_argument ("bad archive header");
+  if (header.version != archive_version) throw std::invalid_argument ("unknown archive version");
+
+  const uint64_t members_offset
+    (sizeof (archive_header) + uint64_t (header.package_count) * sizeof (archive_package));
+  const uint64_t data_offset
+    (members_offset + uint64_t (header.member_count) * sizeof (archive_member));
+  // counts are 32 bit, so the offsets cannot wrap, but data_size can
+  if (data_offset > size || header.data_size != size - data_offset)
+  {
+    throw std::invalid_argument ("archive size mismatch");
+  }
+
+  const archive_package* toc_packages
+    (reinterpret_cast<const archive_package*> (file + sizeof (archive_header)));
+  const archive_member* toc_members
+    (reinterpret_cast<const archive_member*> (file + members_offset));
+  const std::string_view data (file + data_offset, header.data_size);
+  const auto string
+    ( [&] (uint64_t offset, uint64_t size)
+      {
+        if (offset > data.size() || size > data.size() - offset)
+        {
+          throw std::invalid_argument ("archive offset out of bounds");
+        }
+        return data.substr (offset, size);
+      }
+    );
+
+  std::vector<package_view> packages (header.package_count);
+  for (std::size_t p (0); p < packages.size(); ++p)
+  {
+    archive_package const& toc_package (toc_packages[p]);
+    if (uint64_t (toc_package.first_member) + toc_package.member_count > header.member_count)
+    {
+      throw std::invalid_argument ("archive member index out of bounds");
+    }
+
+    package_view& package (packages[p]);
+    package.id = toc_package.id;
+    package.name = string (toc_package.name_offset, toc_package.name_size);
+    package.members.resize (toc_package.member_count);
+    for (std::size_t m (0); m < package.members.size(); ++m)
+    {
+      archive_member const& toc_member (toc_members[toc_package.first_member + m]);
+      member_view& member (package.members[m]);
+      member.sequence = toc_member.sequence;
+      member.include_id = toc_member.include_id;
+      member.id = 0;
+      member.name = string (toc_member.name_offset, toc_member.name_size);
+      member.content.assign (1, string (toc_member.content_offset, toc_member.content_size));
+    }
+  }
+  return packages;
+}
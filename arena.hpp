@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// monotonic storage for strings. memory is taken from large blocks and
+// only freed with the arena, so views into it stay valid as long as the
+// arena, or the one it was adopted by, lives. not thread-safe: allocate
+// up front and fill concurrently instead.
+class arena
+{
+public:
+  explicit arena (std::size_t block_size = 1 << 20)
+    : _block_size (block_size)
+    , _position (nullptr)
+    , _left (0)
+  {}
+
+  // the moved-from arena is left empty, like after adopt(), so that it
+  // does not hand out the rest of a block it no longer owns
+  arena (arena&& other)
+    : _block_size (other._block_size)
+    , _blocks (std::move (other._blocks))
+    , _position (other._position)
+    , _left (other._left)
+  {
+    other._blocks.clear();
+    other._position = nullptr;
+    other._left = 0;
+  }
+  arena& operator= (arena&& other)
+  {
+    if (this != &other)
+    {
+      _block_size = other._block_size;
+      _blocks = std::move (other._blocks);
+      _position = other._position;
+      _left = other._left;
+      other._blocks.clear();
+      other._position = nullptr;
+      other._left = 0;
+    }
+    return *this;
+  }
+  arena (arena const&) = delete;
+  arena& operator= (arena const&) = delete;
+
+  // uninitialized memory for size chars. alignment is at most that of
+  // max_align_t.
+  char* allocate (std::size_t size, std::size_t alignment = 1)
+  {
+    const std::size_t padding
+      ((alignment - reinterpret_cast<std::uintptr_t> (_position) % alignment) % alignment);
+    if (size + padding > _left)
+    {
+      // large requests get a block of their own, so that the current
+      // block is not abandoned half-empty
+      if (size > _block_size / 4)
+      {
+        _blocks.emplace_back (new char[size]);
+        return _blocks.back().get();
+      }
+      _blocks.emplace_back (new char[_block_size]);
+      _position = _blocks.back().get();
+      _left = _block_size;
+    }
+    else
+    {
+      _position += padding;
+      _left -= padding;
+    }
+    char* allocated (_position);
+    _position += size;
+    _left -= size;
+    return allocated;
+  }
+
+  std::string_view copy (std::string_view str)
+  {
+    char* copied (allocate (str.size()));
+    std::memcpy (copied, str.data(), str.size());
+    return {copied, str.size()};
+  }
+
+  // takes over the blocks of other, keeping views into them valid
+  void adopt (arena&& other)
+  {
+    _blocks.insert ( _blocks.end()
+                   , std::make_move_iterator (other._blocks.begin())
+                   , std::make_move_iterator (other._blocks.end())
+                   );
+    other._blocks.clear();
+    other._position = nullptr;
+    other._left = 0;
+  }
+
+  std::size_t blocks() const
+  {
+    return _blocks.size();
+  }
+
+private:
+  std::size_t _block_size;
+  std::vector<std::unique_ptr<char[]>> _blocks;
+  char* _position;
+  std::size_t _left;
+};
+
+// allocator for standard containers whose nodes should come from an
+// arena. deallocation is a no-op, the arena frees everything at once.
+template<typename T>
+struct arena_allocator
+{
+  typedef T value_type;
+
+  explicit arena_allocator (arena& memory)
+    : memory (&memory)
+  {}
+  template<typename U>
+  arena_allocator (arena_allocator<U> const& other)
+    : memory (other.memory)
+  {}
+
+  T* allocate (std::size_t n)
+  {
+    return reinterpret_cast<T*> (memory->allocate (n * sizeof (T), alignof (T)));
+  }
+  void deallocate (T*, std::size_t)
+  {}
+
+  template<typename U>
+  bool operator== (arena_allocator<U> const& other) const
+  {
+    return memory == other.memory;
+  }
+  template<typename U>
+  bool operator!= (arena_allocator<U> const& other) const
+  {
+    return memory != other.memory;
+  }
+
+  arena* memory;
+};
@@ -0,0 +1,376 @@
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "allocation_counter.hpp"
+#include "db2.hpp"
+#include "mapped_file.hpp"
+#include "output_backend.hpp"
+#include "package_view.hpp"
+#include "scene_script_database.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+#include "tree_input.hpp"
+#include "tree_output.hpp"
+
+// times the DB2 and tree code paths on synthetic tables of a given
+// scale, reporting throughput, allocations and read/write syscalls per
+// phase. numbers depend on the machine and file system, so compare runs
+// on the same one.
+
+struct counters
+{
+  std::chrono::steady_clock::time_point time;
+  std::size_t allocations;
+  std::size_t allocated_bytes;
+  std::size_t read_syscalls;
+  std::size_t write_syscalls;
+};
+
+// syscr and syscw of /proc/self/io count read and write syscalls of
+// any kind. without procfs they stay 0.
+counters now()
+{
+  counters c {};
+  std::ifstream io ("/proc/self/io");
+  std::string key;
+  std::size_t value;
+  while (io >> key >> value)
+  {
+    if (key == "syscr:") c.read_syscalls = value;
+    if (key == "syscw:") c.write_syscalls = value;
+  }
+  c.allocations = stats::allocations;
+  c.allocated_bytes = stats::allocated_bytes;
+  c.time = std::chrono::steady_clock::now();
+  return c;
+}
+
+// runs f once and prints a line for it. bytes and rows are what the
+// phase processed, for throughput.
+template<typename F>
+void phase (const char* name, F const& f)
+{
+  const counters before (now());
+  std::pair<std::size_t, std::size_t> bytes_and_rows (f());
+  const counters after (now());
+
+  const double seconds (std::chrono::duration<double> (after.time - before.time).count());
+  std::printf ( "%-14s %9.2f ms %9.1f MiB/s %11.0f rows/s %9zu allocs %11zu bytes %7zu syscr %7zu syscw\n"
+              , name
+              , seconds * 1000
+              , bytes_and_rows.first / seconds / (1 << 20)
+              , bytes_and_rows.second / seconds
+              , after.allocations - before.allocations
+              , after.allocated_bytes - before.allocated_bytes
+              , after.read_syscalls - before.read_syscalls
+              , after.write_syscalls - before.write_syscalls
+              );
+}
+
+struct options
+{
+  std::size_t packages = 1000;
+  std::size_t members = 10;
+  std::size_t content = 2000;
+  double shared = 0.1;
+  double includes = 0.05;
+  std::size_t jobs = 1;
+  unsigned seed = 1;
+  bool io_uring = false;
+};
+
+// packages with scripts of about options.content bytes, so that larger
+// sizes exercise the chunking. a share of the scripts repeats an
+// earlier one, name and content, which the database saves once as a
+// chain shared by both members, and a share of the members includes an
+// earlier package.
+SceneScriptDatabase generate (options const& opts)
+{
+  std::mt19937 rng (opts.seed);
+  std::uniform_real_distribution<double> chance (0.0, 1.0);
+  std::uniform_int_distribution<std::size_t> size (opts.content / 2, opts.content + opts.content / 2);
+
+  const auto script
+    ( [&] (std::size_t bytes)
+      {
+        std::string content;
+        while (content.size() < bytes)
+        {
+          content += "  local v" + std::to_string (rng() % 1000) + " = Scene" + std::to_string (rng() % 100)
+                   + ":Call (" + std::to_string (rng() % 100000) + ", \"text " + std::to_string (rng()) + "\")\n";
+        }
+        content.resize (bytes);
+        return content;
+      }
+    );
+
+  SceneScriptDatabase database;
+  std::vector<std::pair<std::string, std::string>> scripts;
+  for (std::size_t p (1); p <= opts.packages; ++p)
+  {
+    database.add_package (p, "Package " + std::to_string (p));
+    for (std::size_t m (0); m < opts.members; ++m)
+    {
+      if (p > 1 && chance (rng) < opts.includes)
+      {
+        database.relink_include (p, m, 1 + rng() % (p - 1));
+      }
+      else if (!scripts.empty() && chance (rng) < opts.shared)
+      {
+        auto const& copied (scripts[rng() % scripts.size()]);
+        database.set_script (p, m, copied.first, copied.second);
+      }
+      else
+      {
+        scripts.emplace_back ("script " + std::to_string (p) + "." + std::to_string (m), script (size (rng)));
+        database.set_script (p, m, scripts.back().first, scripts.back().second);
+      }
+    }
+  }
+  return database;
+}
+
+int main (int argc, char** argv)
+{
+  options opts;
+  std::string dir;
+  for (int i (1); i < argc; ++i)
+  {
+    const std::string arg (argv[i]);
+    if (arg == "--packages" && i + 1 < argc)
+    {
+      opts.packages = std::stoul (argv[++i]);
+    }
+    else if (arg == "--members" && i + 1 < argc)
+    {
+      opts.members = std::stoul (argv[++i]);
+    }
+    else if (arg == "--content" && i + 1 < argc)
+    {
+      opts.content = std::stoul (argv[++i]);
+    }
+    else if (arg == "--shared" && i + 1 < argc)
+    {
+      opts.shared = std::stod (argv[++i]);
+    }
+    else if (arg == "--includes" && i + 1 < argc)
+    {
+      opts.includes = std::stod (argv[++i]);
+    }
+    else if ((arg == "--jobs" || arg == "-j") && i + 1 < argc)
+    {
+      opts.jobs = std::stoul (argv[++i]);
+    }
+    else if (arg == "--seed" && i + 1 < argc)
+    {
+      opts.seed = std::stoul (argv[++i]);
+    }
+    else if (arg == "--dir" && i + 1 < argc)
+    {
+      dir = argv[++i];
+    }
+    else if (arg == "--io-uring")
+    {
+      opts.io_uring = true;
+    }
+    else
+    {
+      std::cerr << "usage: " << argv[0] << " [--packages N] [--members N] [--content BYTES]"
+                << " [--shared RATIO] [--includes RATIO] [--jobs N] [--seed N] [--dir DIR] [--io-uring]\n";
+      return 1;
+    }
+  }
+
+  // allocations only, the phase timers and counters of stats would add
+  // to the times measured here
+  stats::count_allocations();
+
+  // a scratch directory is removed again, a given one is kept
+  const bool scratch (dir.empty());
+  const boost::filesystem::path work_dir
+    ( scratch
+    ? boost::filesystem::temp_directory_path() / boost::filesystem::unique_path ("scene_scripts_bench_%%%%%%%%")
+    : boost::filesystem::path (dir)
+    );
+  const boost::filesystem::path db2_dir (work_dir / "DBFilesClient");
+  const boost::filesystem::path repack_dir (work_dir / "DBFilesClient_out");
+  const boost::filesystem::path pack_dir (work_dir / "DBFilesClient_tree");
+  const boost::filesystem::path tree_dir (work_dir / "scene_scripts");
+  boost::filesystem::create_directories (db2_dir);
+  boost::filesystem::create_directories (repack_dir);
+  boost::filesystem::create_directories (pack_dir);
+
+  std::ostream quiet (nullptr);
+  const std::string filenames[] = { SceneScriptDatabase::scene_script_filename
+                                  , SceneScriptDatabase::scene_script_package_filename
+                                  , SceneScriptDatabase::scene_script_package_member_filename
+                                  };
+  const auto db2_bytes
+    ( [&] (const boost::filesystem::path in)
+      {
+        std::size_t bytes (0);
+        for (std::string const& filename : filenames)
+        {
+          bytes += boost::filesystem::file_size (in / filename);
+        }
+        return bytes;
+      }
+    );
+
+  SceneScriptDatabase database;
+  scene_script_tables tables;
+  std::size_t rows (0);
+
+  phase ( "generate", [&]
+          {
+            database = generate (opts);
+            tables = database.tables();
+            rows = tables.scripts.size() + tables.packages.size() + tables.members.size();
+            std::size_t bytes (0);
+            for (auto const& script : tables.scripts)
+            {
+              bytes += script.content.size();
+            }
+            return std::make_pair (bytes, rows);
+          }
+        );
+
+  put_records_stats stats;
+  phase ( "put_records", [&]
+          {
+            std::size_t bytes (0);
+            {
+              const std::vector<char> data (put_records<SceneScriptRecRaw> (tables.scripts, stats));
+              write_file (db2_dir / filenames[0], {data.data(), data.size()});
+              bytes += data.size();
+            }
+            {
+              const std::vector<char> data (put_records<SceneScriptPackageRecRaw> (tables.packages, stats));
+              write_file (db2_dir / filenames[1], {data.data(), data.size()});
+              bytes += data.size();
+            }
+            {
+              const std::vector<char> data (put_records<SceneScriptPackageMemberRecRaw> (tables.members, stats));
+              write_file (db2_dir / filenames[2], {data.data(), data.size()});
+              bytes += data.size();
+            }
+            return std::make_pair (bytes, rows);
+          }
+        );
+
+  phase ( "get_records", [&]
+          {
+            const mapped_file scripts ((db2_dir / filenames[0]).string());
+            const mapped_file packages ((db2_dir / filenames[1]).string());
+            const mapped_file members ((db2_dir / filenames[2]).string());
+            const std::size_t decoded
+              ( get_records<SceneScriptRec> (DB2View<SceneScriptRecRaw> (scripts.data(), scripts.size())).size()
+              + get_records<SceneScriptPackageRec> (DB2View<SceneScriptPackageRecRaw> (packages.data(), packages.size())).size()
+              + get_records<SceneScriptPackageMemberRec> (DB2View<SceneScriptPackageMemberRecRaw> (members.data(), members.size())).size()
+              );
+            return std::make_pair (scripts.size() + packages.size() + members.size(), decoded);
+          }
+        );
+
+  phase ( "get_views", [&]
+          {
+            const mapped_file scripts ((db2_dir / filenames[0]).string());
+            const mapped_file packages ((db2_dir / filenames[1]).string());
+            const mapped_file members ((db2_dir / filenames[2]).string());
+            const std::size_t decoded
+              ( get_views (DB2View<SceneScriptRecRaw> (scripts.data(), scripts.size())).size()
+              + get_views (DB2View<SceneScriptPackageRecRaw> (packages.data(), packages.size())).size()
+              + get_views (DB2View<SceneScriptPackageMemberRecRaw> (members.data(), members.size())).size()
+              );
+            return std::make_pair (scripts.size() + packages.size() + members.size(), decoded);
+          }
+        );
+
+  // as the reader does it, from the DB2s to the tree
+  const std::unique_ptr<output_backend> backend (make_output_backend (opts.jobs, opts.io_uring));
+  std::cout << "tree written with " << backend->name() << "\n";
+  const auto export_db2s
+    ( [&]
+      {
+        const mapped_file scripts ((db2_dir / filenames[0]).string());
+        const mapped_file packages ((db2_dir / filenames[1]).string());
+        const mapped_file members ((db2_dir / filenames[2]).string());
+        export_tree ( tree_dir
+                    , packages_from_tables
+                        ( get_views (DB2View<SceneScriptRecRaw> (scripts.data(), scripts.size()))
+                        , get_views (DB2View<SceneScriptPackageRecRaw> (packages.data(), packages.size()))
+                        , get_views (DB2View<SceneScriptPackageMemberRecRaw> (members.data(), members.size()))
+                        )
+                    , opts.jobs
+                    , *backend
+                    , quiet
+                    );
+        return std::make_pair (db2_bytes (db2_dir), rows);
+      }
+    );
+  phase ("export", export_db2s);
+  phase ("export again", export_db2s);
+
+  phase ( "repack", [&]
+          {
+            SceneScriptDatabase::load (db2_dir, opts.jobs).save (repack_dir, quiet);
+            return std::make_pair (db2_bytes (db2_dir) + db2_bytes (repack_dir), rows);
+          }
+        );
+
+  // as the writer does it, from the exported tree back to DB2s
+  phase ( "pack tree", [&]
+          {
+            SceneScriptDatabase packed;
+            read_tree (tree_dir / "by id", packed, opts.jobs);
+            packed.save (pack_dir, quiet);
+            return std::make_pair (db2_bytes (pack_dir), rows);
+          }
+        );
+
+  // members whose chain an earlier member already got, and the content
+  // of the rows they would have needed otherwise. sharing leaves no
+  // duplicate rows for the copy table.
+  std::size_t shared_scripts (0);
+  std::size_t shared_bytes (0);
+  {
+    std::unordered_map<int, SceneScriptRecView const*> scripts_by_id;
+    for (SceneScriptRecView const& script : tables.scripts)
+    {
+      scripts_by_id.emplace (script.id, &script);
+    }
+    std::unordered_set<int> chains;
+    for (SceneScriptPackageMemberRec const& member : tables.members)
+    {
+      if (member.script != 0 && !chains.insert (member.script).second)
+      {
+        ++shared_scripts;
+        for (int id (member.script); id != 0; id = scripts_by_id.at (id)->next_script)
+        {
+          shared_bytes += scripts_by_id.at (id)->content.size();
+        }
+      }
+    }
+  }
+
+  std::cout << rows << " rows, " << tables.scripts.size() << " scripts, "
+            << db2_bytes (db2_dir) << " bytes of DB2s, " << shared_scripts << " shared scripts saving "
+            << shared_bytes << " bytes of content\n";
+
+  if (scratch)
+  {
+    boost::filesystem::remove_all (work_dir);
+  }
+
+  return 0;
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "arena.hpp"
+#include "hash.hpp"
+#include "output_backend.hpp"
+#include "package_view.hpp"
+#include "parallel.hpp"
+#include "scene_script_tables.hpp"
+#include "stats.hpp"
+#include "tree_output.hpp"
+
+// the scene scripts of many builds, for seeing what changed between
+// them: every build is reduced to hashes of its packages and members,
+// and the content of every distinct script is kept once, however many
+// builds have it.
+
+// contents by key, their hash unless that collides, and names, shared
+// by all builds. thread-safe.
+class content_store
+{
+public:
+  content_store()
+    : _strings (1 << 20)
+  {}
+  content_store (content_store const&) = delete;
+  content_store& operator= (content_store const&) = delete;
+
+  // the key of content: the hash of the concatenated pieces or, if
+  // different content has that already, the next key that is free or
+  // has this content. the content is copied if it was not seen before.
+  uint64_t add (content_pieces const& content)
+  {
+    uint64_t hash (fnv1a (""));
+    std::size_t size (0);
+    for (std::string_view piece : content)
+    {
+      hash = fnv1a (piece, hash);
+      size += piece.size();
+    }
+    const auto same_content
+      ( [&] (std::string_view stored)
+        {
+          if (stored.size() != size)
+          {
+            return false;
+          }
+          for (std::string_view piece : content)
+          {
+            if (stored.substr (0, piece.size()) != piece)
+            {
+              return false;
+            }
+            stored.remove_prefix (piece.size());
+          }
+          return true;
+        }
+      );
+
+    const std::lock_guard<std::mutex> lock (_mutex);
+    for (;; ++hash)
+    {
+      const auto stored (_contents.find (hash));
+      if (stored == _contents.end())
+      {
+        break;
+      }
+      if (same_content (stored->second))
+      {
+        return hash;
+      }
+      stats::count ("content hash collisions");
+    }
+
+    char* copy (_strings.allocate (size));
+    std::size_t offset (0);
+    for (std::string_view piece : content)
+    {
+      std::memcpy (copy + offset, piece.data(), piece.size());
+      offset += piece.size();
+    }
+    _contents.emplace (hash, std::string_view (copy, size));
+    return hash;
+  }
+
+  // a copy of str that lives as long as the store
+  std::string_view intern (std::string_view str)
+  {
+    const std::lock_guard<std::mutex> lock (_mutex);
+    const auto name (_names.find (str));
+    if (name != _names.end())
+    {
+      return *name;
+    }
+    return *_names.insert (_strings.copy (str)).first;
+  }
+
+  std::unordered_map<uint64_t, std::string_view> const& contents() const
+  {
+    return _contents;
+  }
+
+private:
+  std::mutex _mutex;
+  arena _strings;
+  std::unordered_map<uint64_t, std::string_view> _contents;
+  std::unordered_set<std::string_view> _names;
+};
+
+// a script's hash or, for includes, the included package
+struct build_member
+{
+  int sequence;
+  std::string_view name;
+  int include_id;
+  uint64_t hash;
+};
+
+// the hash covers the name and all members
+struct build_package
+{
+  int id;
+  std::string_view name;
+  uint64_t hash;
+  std::vector<build_member> members;
+};
+
+// packages sorted by id, members by sequence, names in a content_store
+struct build_summary
+{
+  std::string name;
+  std::vector<build_package> packages;
+};
+
+inline std::string hash_string (uint64_t hash)
+{
+  char buffer[17];
+  std::snprintf (buffer, sizeof (buffer), "%016" PRIx64, hash);
+  return buffer;
+}
+
+// the name of the build in dir: that of the directory, or of its parent
+// for a DBFilesClient directory, as in <build>/DBFilesClient
+inline std::string build_name (boost::filesystem::path dir)
+{
+  if (dir.filename() == "." || dir.filename().empty())
+  {
+    dir = dir.parent_path();
+  }
+  if (dir.filename() == "DBFilesClient" && !dir.parent_path().filename().empty())
+  {
+    dir = dir.parent_path();
+  }
+  return dir.filename().string();
+}
+
+inline build_summary summarize_build ( std::string name
+                                     , std::vector<package_view> const& packages
+                                     , content_store& store
+                                     )
+{
+  build_summary build;
+  build.name = std::move (name);
+  for (package_view const& package_view : packages)
+  {
+    build_package package;
+    package.id = package_view.id;
+    package.name = store.intern (package_view.name);
+    for (member_view const& member : package_view.members)
+    {
+      package.members.push_back
+        ( { member.sequence
+          , store.intern (member.name)
+          , member.include_id
+          , member.include_id == 0 ? store.add (member.content) : 0
+          }
+        );
+    }
+    std::stable_sort ( package.members.begin(), package.members.end()
+                     , [] (build_member const& lhs, build_member const& rhs)
+                       {
+                         return lhs.sequence < rhs.sequence;
+                       }
+                     );
+
+    package.hash = fnv1a (package.name);
+    for (build_member const& member : package.members)
+    {
+      package.hash = fnv1a
+        ( "\n" + std::to_string (member.sequence) + " " + std::to_string (member.include_id)
+        + " " + hash_string (member.hash) + " "
+        , package.hash
+        );
+      package.hash = fnv1a (member.name, package.hash);
+    }
+    build.packages.push_back (std::move (package));
+  }
+  std::stable_sort ( build.packages.begin(), build.packages.end()
+                   , [] (build_package const& lhs, build_package const& rhs)
+                     {
+                       return lhs.id < rhs.id;
+                     }
+                   );
+  return build;
+}
+
+// one line per package, followed by one per member:
+//   p <id> <hash> <name>
+//   m <sequence> <hash> <name>     a script, see contents/<hash>.lua
+//   i <sequence> <package> <name>  an include
+// names come last as they may contain spaces.
+inline std::string build_manifest (build_summary const& build)
+{
+  std::ostringstream manifest;
+  manifest << "scene_scripts build 1\n";
+  for (build_package const& package : build.packages)
+  {
+    manifest << "p " << package.id << ' ' << hash_string (package.hash) << ' ' << package.name << '\n';
+    for (build_member const& member : package.members)
+    {
+      if (member.include_id == 0)
+      {
+        manifest << "m " << member.sequence << ' ' << hash_string (member.hash) << ' ' << member.name << '\n';
+      }
+      else
+      {
+        manifest << "i " << member.sequence << ' ' << member.include_id << ' ' << member.name << '\n';
+      }
+    }
+  }
+  return manifest.str();
+}
+
+struct build_changes
+{
+  std::size_t added;
+  std::size_t removed;
+  std::size_t changed;
+};
+
+// the packages added, removed and changed from old_build to new_build
+// and, for changed ones, their members, as
+//   + <id> <name>, - <id> <name>, ~ <id> <name>
+//     + <sequence> <name>, - <sequence> <name>, ~ <sequence> <name>
+inline build_changes diff_builds (build_summary const& old_build, build_summary const& new_build, std::ostream& report)
+{
+  // walks two sequences sorted by key, calling f with the element of
+  // either or both
+  const auto merge
+    ( [] (auto const& olds, auto const& news, auto key, auto f)
+      {
+        auto old_it (olds.begin());
+        auto new_it (news.begin());
+        while (old_it != olds.end() || new_it != news.end())
+        {
+          if (new_it == news.end() || (old_it != olds.end() && key (*old_it) < key (*new_it)))
+          {
+            f (&*old_it++, nullptr);
+          }
+          else if (old_it == olds.end() || key (*new_it) < key (*old_it))
+          {
+            f (nullptr, &*new_it++);
+          }
+          else
+          {
+            f (&*old_it++, &*new_it++);
+          }
+        }
+      }
+    );
+
+  report << old_build.name << " -> " << new_build.name << "\n";
+  build_changes changes {0, 0, 0};
+  merge ( old_build.packages, new_build.packages
+        , [] (build_package const& package) { return package.id; }
+        , [&] (build_package const* old_package, build_package const* new_package)
+          {
+            if (!old_package)
+            {
+              ++changes.added;
+              report << "+ " << new_package->id << " " << new_package->name << "\n";
+              return;
+            }
+            if (!new_package)
+            {
+              ++changes.removed;
+              report << "- " << old_package->id << " " << old_package->name << "\n";
+              return;
+            }
+            if (old_package->hash == new_package->hash)
+            {
+              return;
+            }
+            ++changes.changed;
+            report << "~ " << new_package->id << " " << new_package->name << "\n";
+            merge ( old_package->members, new_package->members
+                  , [] (build_member const& member) { return member.sequence; }
+                  , [&] (build_member const* old_member, build_member const* new_member)
+                    {
+                      if (!old_member)
+                      {
+                        report << "  + " << new_member->sequence << " " << new_member->name << "\n";
+                      }
+                      else if (!new_member)
+                      {
+                        report << "  - " << old_member->sequence << " " << old_member->name << "\n";
+                      }
+                      else if ( old_member->name != new_member->name
+                             || old_member->include_id != new_member->include_id
+                             || old_member->hash != new_member->hash
+                              )
+                      {
+                        report << "  ~ " << new_member->sequence << " " << new_member->name << "\n";
+                      }
+                    }
+                  );
+          }
+        );
+  return changes;
+}
+
+// summarizes the builds in dirs, up to jobs at a time, and writes to
+// output_dir a manifest per build, every distinct script once as
+// contents/<hash>.lua, and changes.txt with the changes from each build
+// to the next, in the order given. a build's files are only mapped
+// while it is summarized.
+inline void export_builds ( const boost::filesystem::path output_dir
+                          , std::vector<boost::filesystem::path> const& dirs
+                          , std::size_t jobs
+                          , output_backend& backend
+                          , std::ostream& log
+                          )
+{
+  const stats::scope timer ("export builds");
+  if (dirs.empty())
+  {
+    throw std::invalid_argument ("no builds given");
+  }
+
+  std::vector<std::string> names;
+  {
+    std::unordered_set<std::string> unique_names;
+    for (boost::filesystem::path const& dir : dirs)
+    {
+      names.push_back (build_name (dir));
+      if (names.back().empty() || !unique_names.insert (names.back()).second)
+      {
+        throw std::invalid_argument ("builds need distinct directory names: " + dir.string());
+      }
+    }
+  }
+
+  content_store store;
+  std::vector<build_summary> builds (dirs.size());
+  parallel_for (jobs, dirs.size(), [&] (std::size_t i)
+    {
+      const stats::scope build_timer ("summarize build");
+      const mapped_scene_script_tables tables (read_scene_script_tables (dirs[i], 1));
+      builds[i] = summarize_build (names[i], tables.packages(), store);
+    }
+  );
+
+  const boost::filesystem::path contents_dir (output_dir / "contents");
+  boost::filesystem::create_directories (contents_dir);
+  const directory contents (contents_dir.string());
+  std::vector<output_op> ops;
+  for (auto const& content : store.contents())
+  {
+    std::string name (hash_string (content.first) + ".lua");
+    const file_state state (compare_file (contents, name, content_pieces (1, content.second)));
+    if (state != file_state::same)
+    {
+      ops.push_back ({&contents, std::move (name), false, content_pieces (1, content.second), state != file_state::missing, {}});
+    }
+  }
+  {
+    const stats::scope write_timer (std::string ("write contents with ") + backend.name());
+    backend.run (ops);
+  }
+
+  std::ostringstream report;
+  for (std::size_t i (0); i < builds.size(); ++i)
+  {
+    write_file_if_changed (output_dir / (builds[i].name + ".manifest"), build_manifest (builds[i]));
+    if (i > 0)
+    {
+      const build_changes changes (diff_builds (builds[i - 1], builds[i], report));
+      log << builds[i - 1].name << " -> " << builds[i].name << ": " << changes.added << " added, "
+          << changes.removed << " removed, " << changes.changed << " changed\n";
+    }
+  }
+  write_file_if_changed (output_dir / "changes.txt", report.str());
+
+  stats::count ("builds", builds.size());
+  stats::count ("distinct scripts", store.contents().size());
+  log << output_dir.string() << ": " << builds.size() << " builds, " << store.contents().size()
+      << " distinct scripts, " << ops.size() << " written\n";
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the client reads at most this many bytes of content per SceneScript
+// row
+constexpr std::size_t client_chunk_limit (4000);
+
+// how scripts are split into SceneScript rows when saving. compact
+// strips comments and layout first, see compact_lua().
+struct chunk_options
+{
+  std::size_t max_size = client_chunk_limit;
+  bool compact = false;
+};
+
+inline void check_chunk_options (chunk_options const& options)
+{
+  if (options.max_size == 0 || options.max_size > client_chunk_limit)
+  {
+    throw std::invalid_argument
+      ( "chunk size " + std::to_string (options.max_size) + " not in 1.."
+      + std::to_string (client_chunk_limit)
+      );
+  }
+}
+
+// content in pieces of at most max_size bytes, each ending after the
+// last newline that fits. lines longer than max_size are split within.
+// empty content is one empty chunk, as every script has a row.
+inline std::vector<std::string_view> split_into_chunks (std::string_view content, std::size_t max_size)
+{
+  std::vector<std::string_view> chunks;
+  while (content.size() > max_size)
+  {
+    std::size_t size (content.rfind ('\n', max_size - 1) + 1);
+    if (size == 0)
+    {
+      size = max_size;
+    }
+    chunks.push_back (content.substr (0, size));
+    content.remove_prefix (size);
+  }
+  if (!content.empty() || chunks.empty())
+  {
+    chunks.push_back (content);
+  }
+  return chunks;
+}
+
+// the same Lua program without comments, indentation, trailing
+// whitespace and blank lines, with runs of spaces collapsed and spaces
+// next to brackets, commas and semicolons removed. strings, including
+// long ones, are kept as they are, and line breaks between statements
+// stay, so that no two lines become an ambiguous call. line numbers in
+// error messages no longer match the source.
+inline std::string compact_lua (std::string_view source)
+{
+  // the length of the long bracket, [[ or [==[, at source[i], or 0
+  const auto long_bracket
+    ( [&] (std::size_t i)
+      {
+        if (i >= source.size() || source[i] != '[')
+        {
+          return std::size_t (0);
+        }
+        std::size_t end (i + 1);
+        while (end < source.size() && source[end] == '=')
+        {
+          ++end;
+        }
+        return end < source.size() && source[end] == '[' ? end + 1 - i : std::size_t (0);
+      }
+    );
+  // the end of the long string or comment opened by a bracket of
+  // length open_size at source[i]
+  const auto long_end
+    ( [&] (std::size_t i, std::size_t open_size)
+      {
+        const std::string close ("]" + std::string (open_size - 2, '=') + "]");
+        const std::size_t end (source.find (close, i + open_size));
+        return end == std::string_view::npos ? source.size() : end + close.size();
+      }
+    );
+  const auto separates_itself
+    ( [] (char c)
+      {
+        return c != '\0' && std::strchr ("(){},;", c);
+      }
+    );
+
+  std::string compacted;
+  compacted.reserve (source.size());
+  bool pending_space (false);
+  bool pending_newline (false);
+  const auto emit
+    ( [&] (std::string_view token)
+      {
+        if (!compacted.empty())
+        {
+          if (pending_newline)
+          {
+            compacted += '\n';
+          }
+          else if ( pending_space
+                 && !separates_itself (compacted.back())
+                 && !separates_itself (token.front())
+                  )
+          {
+            compacted += ' ';
+          }
+        }
+        pending_space = pending_newline = false;
+        compacted += token;
+      }
+    );
+
+  std::size_t i (0);
+  while (i < source.size())
+  {
+    const char c (source[i]);
+    if (c == '-' && i + 1 < source.size() && source[i + 1] == '-')
+    {
+      const std::size_t open_size (long_bracket (i + 2));
+      const std::size_t end
+        (open_size ? long_end (i + 2, open_size) : std::min (source.find ('\n', i), source.size()));
+      pending_space = true;
+      pending_newline |= source.substr (i, end - i).find ('\n') != std::string_view::npos;
+      i = end;
+    }
+    else if (c == '\n')
+    {
+      pending_newline = true;
+      ++i;
+    }
+    else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+    {
+      pending_space = true;
+      ++i;
+    }
+    else if (c == '"' || c == '\'')
+    {
+      std::size_t end (i + 1);
+      while (end < source.size() && source[end] != c)
+      {
+        end += source[end] == '\\' ? 2 : 1;
+      }
+      end = std::min (end + 1, source.size());
+      emit (source.substr (i, end - i));
+      i = end;
+    }
+    else if (const std::size_t open_size = long_bracket (i))
+    {
+      const std::size_t end (long_end (i, open_size));
+      emit (source.substr (i, end - i));
+      i = end;
+    }
+    else
+    {
+      emit (source.substr (i, 1));
+      ++i;
+    }
+  }
+  if (pending_newline && !compacted.empty())
+  {
+    compacted += '\n';
+  }
+  return compacted;
+}
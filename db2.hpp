@@ -0,0 +1,767 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "id_index.hpp"
+#include "string_pool.hpp"
+#include "string_table.hpp"
+#include "structures.hpp"
+
+struct copy_table_entry
+{
+  uint32_t id_of_new_row;
+  uint32_t id_of_copied_row;
+};
+static_assert (sizeof (copy_table_entry) == 0x8, "size of copy_table_entry");
+
+// typed, random-access view of a WDB6 file in memory, usually a
+// mapped_file. nothing is copied: records are read in place and strings
+// are views into the string table, so the backing memory has to outlive
+// the view and everything obtained from it.
+// files laid out exactly like RawRec are read through it directly. other
+// layouts of the same table are decoded column by column: ids inline in
+// the record instead of in the id list, variable-sized records with
+// inline strings found through the offset map (flags & 1), and trailing
+// columns moved into the common data table.
+template<typename RawRec>
+class DB2View
+{
+public:
+  typedef typename RawRec::view_type view_type;
+  typedef typename RawRec::fields fields;
+
+  DB2View (const char* data, std::size_t size)
+    : _header (reinterpret_cast<const DB2Header*> (data))
+    , _records (nullptr)
+    , _ids (nullptr)
+  {
+    if (size < sizeof (DB2Header)) throw std::invalid_argument ("file too small");
+    if (_header->magic != '6BDW') throw std::invalid_argument ("bad header");
+    if (_header->flags & ~5) throw std::invalid_argument ("unknown flags");
+    if (_header->layout_hash != RawRec::layout_hash) throw std::invalid_argument ("layout hash mismatch");
+
+    const bool offset_map (_header->flags & 1);
+    const bool inline_ids (!(_header->flags & 4));
+    if (_header->total_field_count != fields::count + inline_ids) throw std::invalid_argument ("field count mismatch");
+    if (_header->field_count > _header->total_field_count) throw std::invalid_argument ("field count mismatch");
+    if (inline_ids && _header->id_index >= _header->field_count) throw std::invalid_argument ("id not in record");
+
+    const uint64_t layout_offset (sizeof (DB2Header));
+    const uint64_t records_offset
+      (layout_offset + sizeof (uint32_t) * uint64_t (_header->field_count));
+    if (records_offset > size) throw std::invalid_argument ("file truncated");
+    _layout = reinterpret_cast<const uint16_t*> (data + layout_offset);
+
+    uint64_t ids_offset;
+    if (offset_map)
+    {
+      // string_table_size is the absolute offset of the offset map then
+      const uint64_t map_offset (_header->string_table_size);
+      const uint64_t entries
+        (_header->max_id >= _header->min_id ? uint64_t (_header->max_id) - _header->min_id + 1 : 0);
+      ids_offset = map_offset + offset_map_entry_size * entries;
+      if (map_offset < records_offset || ids_offset > size) throw std::invalid_argument ("file truncated");
+      for (uint64_t i (0); i < entries; ++i)
+      {
+        uint32_t offset;
+        uint16_t length;
+        std::memcpy (&offset, data + map_offset + offset_map_entry_size * i, sizeof (offset));
+        std::memcpy (&length, data + map_offset + offset_map_entry_size * i + sizeof (offset), sizeof (length));
+        if (length == 0) continue;
+        if (offset < records_offset || uint64_t (offset) + length > map_offset) throw std::invalid_argument ("record outside of file");
+        _rows.push_back ({data + offset, length, uint32_t (_header->min_id + i)});
+      }
+    }
+    else
+    {
+      ids_offset
+        = records_offset
+        + uint64_t (_header->record_count) * _header->record_size
+        + _header->string_table_size;
+      _records = data + records_offset;
+      _strings = string_table
+        ( _records + uint64_t (_header->record_count) * _header->record_size
+        , _header->string_table_size
+        );
+    }
+    const uint64_t copies_offset
+      (ids_offset + (inline_ids ? 0 : sizeof (uint32_t) * uint64_t (_header->record_count)));
+    const uint64_t common_data_offset (copies_offset + _header->copy_table_size);
+    if (common_data_offset + _header->common_data_table_size > size) throw std::invalid_argument ("file truncated");
+
+    // the offset map is indexed by id already
+    if (!inline_ids && !offset_map)
+    {
+      _ids = reinterpret_cast<const uint32_t*> (data + ids_offset);
+    }
+    _copies = reinterpret_cast<const copy_table_entry*> (data + copies_offset);
+
+    _raw_layout
+      =  _header->flags == 4
+      && _header->field_count == fields::count
+      && _header->record_size == sizeof (RawRec)
+      && std::memcmp (_layout, RawRec::field_layout.data(), sizeof (RawRec::field_layout)) == 0;
+    read_columns (inline_ids);
+    read_common_data (data + common_data_offset, _header->common_data_table_size);
+    validate_strings();
+  }
+
+  DB2Header const& header() const
+  {
+    return *_header;
+  }
+  // whether raw() may be used, i.e. records are RawRecs
+  bool raw_layout() const
+  {
+    return _raw_layout;
+  }
+
+  std::size_t size() const
+  {
+    return _header->flags & 1 ? _rows.size() : _header->record_count;
+  }
+  RawRec const& raw (std::size_t i) const
+  {
+    return reinterpret_cast<const RawRec*> (_records)[i];
+  }
+  int id (std::size_t i) const
+  {
+    if (_ids)
+    {
+      return _ids[i];
+    }
+    else if (_header->flags & 1)
+    {
+      return _rows[i].id;
+    }
+    return read_integer (_records + i * _header->record_size + _id_column.offset, _id_column.bytes);
+  }
+  view_type operator[] (std::size_t i) const
+  {
+    return _raw_layout ? raw (i).view (_strings, id (i)) : decode<view_type> (i);
+  }
+
+  // decodes a row of any layout, Row being a record or a record view
+  template<typename Row>
+  Row decode (std::size_t i) const
+  {
+    Row row;
+    row.id = id (i);
+    if (_header->flags & 1)
+    {
+      decode_variable (row, _rows[i]);
+    }
+    else
+    {
+      const char* record (_records + i * _header->record_size);
+      for (std::size_t c (0); c < fields::count; ++c)
+      {
+        if (_columns[c].common == npos)
+        {
+          Row::fields::assign
+            (row, c, read_integer (record + _columns[c].offset, _columns[c].bytes), _strings);
+        }
+      }
+    }
+    for (std::size_t c (0); c < fields::count; ++c)
+    {
+      if (_columns[c].common != npos)
+      {
+        Row::fields::assign (row, c, common_value (_columns[c].common, row.id), _strings);
+      }
+    }
+    return row;
+  }
+
+  string_table const& strings() const
+  {
+    return _strings;
+  }
+
+  std::size_t copy_count() const
+  {
+    return _header->copy_table_size / sizeof (copy_table_entry);
+  }
+  copy_table_entry const& copy (std::size_t i) const
+  {
+    return _copies[i];
+  }
+
+private:
+  static constexpr std::size_t npos = std::size_t (-1);
+  static constexpr std::size_t offset_map_entry_size = sizeof (uint32_t) + sizeof (uint16_t);
+
+  // where a column of the table is found in this file
+  struct column
+  {
+    std::size_t offset;
+    std::size_t bytes;
+    std::size_t common;
+  };
+  // a record found through the offset map
+  struct variable_row
+  {
+    const char* data;
+    std::size_t size;
+    uint32_t id;
+  };
+
+  static uint32_t read_integer (const char* data, std::size_t bytes)
+  {
+    uint32_t value (0);
+    std::memcpy (&value, data, bytes);
+    return value;
+  }
+
+  void read_columns (bool inline_ids)
+  {
+    _columns.resize (fields::count);
+    _file_columns.resize (_header->field_count);
+    for (std::size_t f (0), c (0); f < _header->total_field_count; ++f)
+    {
+      const bool is_id (inline_ids && f == _header->id_index);
+      column col {0, 4, npos};
+      if (f < _header->field_count)
+      {
+        const uint16_t width (_layout[2 * f]);
+        if (width >= 32 || width % 8 != 0) throw std::invalid_argument ("unsupported field size");
+        col.offset = _layout[2 * f + 1];
+        col.bytes = (32 - width) / 8;
+        if (!(_header->flags & 1) && col.offset + col.bytes > _header->record_size)
+        {
+          throw std::invalid_argument ("field outside of record");
+        }
+        _file_columns[f] = is_id ? npos : c;
+      }
+      else
+      {
+        col.common = f - _header->field_count;
+        if (fields::strings()[c] && (_header->flags & 1)) throw std::invalid_argument ("common data string without string table");
+      }
+
+      if (is_id)
+      {
+        _id_column = col;
+      }
+      else
+      {
+        _columns[c++] = col;
+      }
+    }
+  }
+
+  // the table starts with the number of columns, each column with its
+  // number of entries and their type, followed by that many id and
+  // value pairs. values are padded to 4 bytes.
+  void read_common_data (const char* data, std::size_t size)
+  {
+    _common.resize (_header->total_field_count - _header->field_count);
+    if (size == 0)
+    {
+      return;
+    }
+
+    std::size_t position (0);
+    const auto read ([&] (void* out, std::size_t bytes)
+                     {
+                       if (position + bytes > size) throw std::invalid_argument ("common data truncated");
+                       std::memcpy (out, data + position, bytes);
+                       position += bytes;
+                     }
+                    );
+
+    uint32_t column_count;
+    read (&column_count, sizeof (column_count));
+    if (column_count != _header->total_field_count) throw std::invalid_argument ("common data column count mismatch");
+    for (uint32_t f (0); f < column_count; ++f)
+    {
+      uint32_t count;
+      uint8_t type;
+      read (&count, sizeof (count));
+      read (&type, sizeof (type));
+      if (uint64_t (count) * 2 * sizeof (uint32_t) > size - position) throw std::invalid_argument ("common data truncated");
+      if (count != 0 && f < _header->field_count) throw std::invalid_argument ("common data for a column in the record");
+
+      std::vector<std::pair<uint32_t, uint32_t>> entries (count);
+      for (auto& entry : entries)
+      {
+        read (&entry.first, sizeof (entry.first));
+        read (&entry.second, sizeof (entry.second));
+      }
+      if (f >= _header->field_count)
+      {
+        std::sort (entries.begin(), entries.end());
+        _common[f - _header->field_count] = std::move (entries);
+      }
+    }
+  }
+
+  // all string offsets, in the records and in the common data, have to
+  // be followed by a NUL in the string table, see string_table. that is
+  // the case for all of them if it is for the largest one.
+  void validate_strings() const
+  {
+    if (_header->flags & 1)
+    {
+      return;
+    }
+
+    bool has_strings (false);
+    uint32_t max_offset (0);
+    for (std::size_t c (0); c < fields::count; ++c)
+    {
+      if (!fields::strings()[c])
+      {
+        continue;
+      }
+      if (_columns[c].common == npos)
+      {
+        const char* field (_records + _columns[c].offset);
+        for (std::size_t i (0); i < _header->record_count; ++i, field += _header->record_size)
+        {
+          max_offset = std::max (max_offset, read_integer (field, _columns[c].bytes));
+        }
+        has_strings = has_strings || _header->record_count != 0;
+      }
+      else
+      {
+        for (auto const& entry : _common[_columns[c].common])
+        {
+          max_offset = std::max (max_offset, entry.second);
+        }
+        // rows without an entry read offset 0
+        has_strings = has_strings || _header->record_count != 0;
+      }
+    }
+    if (has_strings && !_strings.valid (max_offset))
+    {
+      throw std::invalid_argument ("string offset outside of string table");
+    }
+  }
+
+  // rows without an entry have the column's default, zero
+  uint32_t common_value (std::size_t column, uint32_t id) const
+  {
+    auto const& entries (_common[column]);
+    const auto entry
+      ( std::lower_bound ( entries.begin(), entries.end(), id
+                         , [] (std::pair<uint32_t, uint32_t> const& entry, uint32_t id)
+                           {
+                             return entry.first < id;
+                           }
+                         )
+      );
+    return entry != entries.end() && entry->first == id ? entry->second : 0;
+  }
+
+  // fields of variable-sized records are packed in order, strings are
+  // stored inline and terminated by NUL
+  template<typename Row>
+  void decode_variable (Row& row, variable_row const& record) const
+  {
+    const char* position (record.data);
+    const char* const end (record.data + record.size);
+    for (std::size_t f (0); f < _header->field_count; ++f)
+    {
+      const std::size_t c (_file_columns[f]);
+      if (c != npos && fields::strings()[c])
+      {
+        const void* nul (std::memchr (position, 0, end - position));
+        if (!nul) throw std::invalid_argument ("unterminated string in record");
+        Row::fields::assign_string
+          (row, c, std::string_view (position, static_cast<const char*> (nul) - position));
+        position = static_cast<const char*> (nul) + 1;
+      }
+      else
+      {
+        const std::size_t bytes (c != npos ? _columns[c].bytes : _id_column.bytes);
+        if (std::size_t (end - position) < bytes) throw std::invalid_argument ("field outside of record");
+        if (c != npos)
+        {
+          Row::fields::assign (row, c, read_integer (position, bytes), _strings);
+        }
+        position += bytes;
+      }
+    }
+  }
+
+  const DB2Header* _header;
+  const uint16_t* _layout;
+  const char* _records;
+  string_table _strings;
+  const uint32_t* _ids;
+  const copy_table_entry* _copies;
+  bool _raw_layout;
+
+  std::vector<column> _columns;
+  std::vector<std::size_t> _file_columns;
+  column _id_column;
+  // only filled for layouts other than RawRec's
+  std::vector<variable_row> _rows;
+  std::vector<std::vector<std::pair<uint32_t, uint32_t>>> _common;
+};
+
+// appends the rows of the copy table to rows, which holds the decoded
+// real rows in table order. Row is a record or a record view.
+template<typename Row, typename RawRec>
+void append_copies (DB2View<RawRec> const& db2, std::vector<Row>& rows)
+{
+  rows.reserve (rows.size() + db2.copy_count());
+
+  int min_id (std::numeric_limits<int>::max());
+  int max_id (std::numeric_limits<int>::min());
+  for (Row const& row : rows)
+  {
+    min_id = std::min (min_id, row.id);
+    max_id = std::max (max_id, row.id);
+  }
+
+  std::unordered_map<int, std::size_t> copies_by_new_id;
+  for (std::size_t i (0); i < db2.copy_count(); ++i)
+  {
+    const int new_id (db2.copy (i).id_of_new_row);
+    copies_by_new_id.emplace (new_id, i);
+    min_id = std::min (min_id, new_id);
+    max_id = std::max (max_id, new_id);
+  }
+
+  id_index index (min_id, max_id, rows.capacity());
+  for (std::size_t row (0); row < rows.size(); ++row)
+  {
+    index.insert (rows[row].id, row);
+  }
+
+  // a copy may copy a row that is itself only created by a later copy,
+  // so follow the chain back to a real row and create the rows in
+  // reverse, each of them exactly once.
+  std::vector<bool> copied (db2.copy_count(), false);
+  std::vector<std::size_t> chain;
+  for (std::size_t i (0); i < db2.copy_count(); ++i)
+  {
+    std::size_t row (id_index::npos);
+    for (std::size_t c (i); !copied[c]; )
+    {
+      chain.push_back (c);
+      row = index.find (db2.copy (c).id_of_copied_row);
+      if (row != id_index::npos)
+      {
+        break;
+      }
+
+      const auto next (copies_by_new_id.find (db2.copy (c).id_of_copied_row));
+      if (next == copies_by_new_id.end()) throw std::invalid_argument ("copy of unknown row");
+      if (chain.size() > db2.copy_count()) throw std::invalid_argument ("copy table has a cycle");
+      c = next->second;
+    }
+
+    for (; !chain.empty(); chain.pop_back())
+    {
+      const std::size_t c (chain.back());
+      if (row == id_index::npos)
+      {
+        row = index.find (db2.copy (c).id_of_copied_row);
+      }
+      Row copy (rows[row]);
+      copy.id = db2.copy (c).id_of_new_row;
+      rows.push_back (copy);
+      row = rows.size() - 1;
+      index.insert (rows[row].id, row);
+      copied[c] = true;
+    }
+  }
+}
+
+template<typename Rec, typename RawRec>
+std::vector<Rec> get_records (DB2View<RawRec> const& db2)
+{
+  std::vector<Rec> records;
+  records.reserve (db2.size() + db2.copy_count());
+  for (std::size_t i (0); i < db2.size(); ++i)
+  {
+    records.push_back ( db2.raw_layout()
+                      ? db2.raw (i).unraw (db2.header(), db2.strings(), db2.id (i))
+                      : db2.template decode<Rec> (i)
+                      );
+  }
+  append_copies (db2, records);
+  return records;
+}
+
+// like get_records, but without copying any strings
+template<typename RawRec>
+std::vector<typename RawRec::view_type> get_views (DB2View<RawRec> const& db2)
+{
+  std::vector<typename RawRec::view_type> views;
+  views.reserve (db2.size() + db2.copy_count());
+  for (std::size_t i (0); i < db2.size(); ++i)
+  {
+    views.push_back (db2[i]);
+  }
+  append_copies (db2, views);
+  return views;
+}
+
+inline void write_file (const boost::filesystem::path filename, std::string_view data)
+{
+  if (FILE* fp = fopen (filename.string().c_str(), "w"))
+  {
+    const bool written (fwrite (data.data(), 1, data.size(), fp) == data.size());
+    if (fclose (fp) != 0 || !written)
+    {
+      throw std::runtime_error ("file not written: " + filename.string());
+    }
+  }
+  else
+  {
+    throw std::runtime_error ("file not opened: " + filename.string());
+  }
+}
+
+struct put_records_stats
+{
+  std::size_t copy_table_savings;
+  std::size_t string_table_savings;
+  std::size_t common_data_savings;
+};
+
+// the value of a column of an encoded record, for strings the offset
+template<typename Raw>
+uint32_t column_value (Raw const& raw, std::size_t column)
+{
+  uint32_t value (0);
+  std::memcpy (&value, raw.bytes + Raw::fields::offsets()[column], Raw::fields::widths()[column]);
+  return value;
+}
+
+// type of a column in the common data table
+inline uint8_t common_data_type (bool is_string, std::size_t bytes)
+{
+  return is_string ? 0 : bytes == 2 ? 1 : bytes == 1 ? 2 : 4;
+}
+
+// strings are interned, see string_pool. rows that are byte-identical
+// apart from their id are only written once, the others are emitted as
+// copy table entries referring to the first one.
+// with common_data, the trailing columns whose values are mostly zero
+// are moved into the common data table if that makes the file smaller.
+// the file is built in two passes: the first one lays out the string
+// block, finds the copies and counts the non-zero values per column,
+// which gives the exact file size, the second one encodes straight into
+// the single allocation of that size.
+template<typename Raw, typename Rec>
+std::vector<char> put_records (std::vector<Rec> const& recs, put_records_stats& stats, bool common_data = false)
+{
+  typedef typename Raw::fields fields;
+
+  string_pool strings;
+  for (auto const& rec : recs)
+  {
+    Raw::add_strings (rec, strings);
+  }
+  strings.build();
+  std::vector<char> const& stringblock (strings.block());
+
+  // with interned strings, equal rows have equal raw records
+  typedef std::array<char, sizeof (Raw)> raw_bytes;
+  struct raw_bytes_hash
+  {
+    std::size_t operator() (raw_bytes const& bytes) const
+    {
+      return std::hash<std::string_view>() (std::string_view (bytes.data(), bytes.size()));
+    }
+  };
+  typedef std::pair<const raw_bytes, uint32_t> canonical_entry;
+  arena nodes (1 << 16);
+  std::unordered_map< raw_bytes, uint32_t, raw_bytes_hash, std::equal_to<raw_bytes>
+                    , arena_allocator<canonical_entry>
+                    > canonical_ids ( recs.size(), raw_bytes_hash(), std::equal_to<raw_bytes>()
+                                  , arena_allocator<canonical_entry> (nodes)
+                                  );
+  std::vector<bool> is_copy (recs.size(), false);
+  std::vector<uint32_t> copy_of (recs.size());
+  std::size_t copy_count (0);
+  std::array<std::size_t, fields::count> non_zero {};
+
+  for (std::size_t i (0); i < recs.size(); ++i)
+  {
+    const Raw raw (Raw::encode (recs[i], strings));
+    raw_bytes bytes;
+    std::memcpy (bytes.data(), &raw, sizeof (Raw));
+
+    const auto canonical (canonical_ids.emplace (bytes, recs[i].id));
+    if (!canonical.second)
+    {
+      is_copy[i] = true;
+      copy_of[i] = canonical.first->second;
+      ++copy_count;
+    }
+    else
+    {
+      for (std::size_t c (0); c < fields::count; ++c)
+      {
+        non_zero[c] += column_value<Raw> (raw, c) != 0;
+      }
+    }
+  }
+  canonical_ids.clear();
+
+  const std::size_t record_count (recs.size() - copy_count);
+
+  // the common data table lists every column, the ones kept in the
+  // record with no entries
+  const auto common_data_size
+    ( [&] (std::size_t columns)
+      {
+        std::size_t size (sizeof (uint32_t) + fields::count * (sizeof (uint32_t) + sizeof (uint8_t)));
+        for (std::size_t c (columns); c < fields::count; ++c)
+        {
+          size += non_zero[c] * 2 * sizeof (uint32_t);
+        }
+        return size;
+      }
+    );
+  const auto size_with_columns
+    ( [&] (std::size_t columns)
+      {
+        return sizeof (uint32_t) * columns
+          + fields::record_size (columns) * record_count
+          + (columns < fields::count ? common_data_size (columns) : 0);
+      }
+    );
+
+  std::size_t record_columns (fields::count);
+  if (common_data)
+  {
+    for (std::size_t columns (1); columns < fields::count; ++columns)
+    {
+      if (size_with_columns (columns) < size_with_columns (record_columns))
+      {
+        record_columns = columns;
+      }
+    }
+  }
+  const std::size_t record_size (fields::record_size (record_columns));
+  const std::size_t record_bytes (fields::offsets()[record_columns]);
+
+  const std::size_t layout_offset (sizeof (DB2Header));
+  const std::size_t records_offset (layout_offset + sizeof (uint32_t) * record_columns);
+  const std::size_t stringblock_offset (records_offset + record_size * record_count);
+  const std::size_t ids_offset (stringblock_offset + stringblock.size());
+  const std::size_t copies_offset (ids_offset + sizeof (uint32_t) * record_count);
+  const std::size_t common_data_offset (copies_offset + sizeof (copy_table_entry) * copy_count);
+  const std::size_t filesize
+    (common_data_offset + (record_columns < fields::count ? common_data_size (record_columns) : 0));
+
+  std::vector<char> data (filesize);
+
+  {
+    DB2Header* header (reinterpret_cast<DB2Header*> (data.data()));
+
+    header->magic = '6BDW';
+    header->record_count = record_count;
+    header->field_count = record_columns;
+    static_assert (sizeof (Rec) % 4 == 0, "assume all-4byte-fields");
+    header->record_size = record_size;
+    header->table_hash = Raw::table_hash;
+    header->layout_hash = Raw::layout_hash;
+
+    header->min_id = 0x7fffffff;
+    header->max_id = 0;
+    for (auto const& rec : recs)
+    {
+      header->min_id = std::min<uint32_t> (header->min_id, rec.id);
+      header->max_id = std::max<uint32_t> (header->max_id, rec.id);
+    }
+
+    header->locale = -1;
+    header->string_table_size = stringblock.size();
+    header->copy_table_size = copy_count * sizeof (copy_table_entry);
+    header->flags = 4;
+    header->id_index = 0;
+    header->total_field_count = fields::count;
+    header->common_data_table_size = filesize - common_data_offset;
+  }
+
+  static_assert ( sizeof (Raw::field_layout) == sizeof (uint32_t) * (Raw::field_count - 1)
+                , "field_layout has two entries per field but the id"
+                );
+  std::memcpy (data.data() + layout_offset, Raw::field_layout.data(), records_offset - layout_offset);
+  std::memcpy (data.data() + stringblock_offset, stringblock.data(), stringblock.size());
+
+  // entries of the common data columns, each column after the previous
+  std::array<char*, fields::count> common_entries {};
+  if (record_columns < fields::count)
+  {
+    char* position (data.data() + common_data_offset);
+    const uint32_t column_count (fields::count);
+    std::memcpy (position, &column_count, sizeof (column_count));
+    position += sizeof (column_count);
+    for (std::size_t c (0); c < fields::count; ++c)
+    {
+      const uint32_t count (c < record_columns ? 0 : non_zero[c]);
+      const uint8_t type (common_data_type (fields::strings()[c], fields::widths()[c]));
+      std::memcpy (position, &count, sizeof (count));
+      std::memcpy (position + sizeof (count), &type, sizeof (type));
+      position += sizeof (count) + sizeof (type);
+      common_entries[c] = position;
+      position += count * 2 * sizeof (uint32_t);
+    }
+  }
+
+  char* record (data.data() + records_offset);
+  char* id (data.data() + ids_offset);
+  char* copy (data.data() + copies_offset);
+  for (std::size_t i (0); i < recs.size(); ++i)
+  {
+    const uint32_t rec_id (recs[i].id);
+    if (is_copy[i])
+    {
+      const copy_table_entry entry {rec_id, copy_of[i]};
+      std::memcpy (copy, &entry, sizeof (entry));
+      copy += sizeof (entry);
+    }
+    else
+    {
+      const Raw raw (Raw::encode (recs[i], strings));
+      std::memcpy (record, &raw, record_bytes);
+      record += record_size;
+      std::memcpy (id, &rec_id, sizeof (rec_id));
+      id += sizeof (rec_id);
+
+      for (std::size_t c (record_columns); c < fields::count; ++c)
+      {
+        const uint32_t value (column_value<Raw> (raw, c));
+        if (value != 0)
+        {
+          std::memcpy (common_entries[c], &rec_id, sizeof (rec_id));
+          std::memcpy (common_entries[c] + sizeof (rec_id), &value, sizeof (value));
+          common_entries[c] += 2 * sizeof (uint32_t);
+        }
+      }
+    }
+  }
+
+  // a copy would have been a record as written, which moving columns to
+  // the common data table makes smaller than Raw, and an id
+  stats.copy_table_savings
+    = copy_count * (record_size + sizeof (uint32_t) - sizeof (copy_table_entry));
+  stats.string_table_savings = strings.added_bytes() + 2 - stringblock.size();
+  stats.common_data_savings = size_with_columns (fields::count) - size_with_columns (record_columns);
+
+  return data;
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "string_pool.hpp"
+#include "string_table.hpp"
+
+struct DB2Header;
+
+// compile-time description of a DB2 record: the raw struct, its
+// encoding and decoding and the field_layout written to the header are
+// all generated from a single list of fields, see structures.hpp.
+
+template<typename T> struct member_pointer_traits;
+template<typename Class, typename T>
+struct member_pointer_traits<T Class::*>
+{
+  typedef Class class_type;
+  typedef T member_type;
+};
+
+// one column. Size is the field_layout size entry, i.e. 32 minus the
+// width in bits: 0 is 32 bits, 0x10 is 16 bits, 0x18 is 8 bits. the
+// member is either an int or, for string table offsets, a std::string
+// or std::string_view. integers are range checked when encoding.
+template<auto Member, uint16_t Size>
+struct db2_field
+{
+  typedef typename member_pointer_traits<decltype (Member)>::class_type class_type;
+  typedef typename member_pointer_traits<decltype (Member)>::member_type member_type;
+
+  static constexpr bool is_string = !std::is_integral<member_type>::value;
+  static constexpr uint16_t size = Size;
+  static constexpr std::size_t bytes = (32 - Size) / 8;
+
+  static_assert (Size < 32 && Size % 8 == 0, "fields are one to four whole bytes");
+  static_assert (!is_string || Size == 0, "string table offsets are 32 bit");
+  static_assert (is_string || sizeof (member_type) >= bytes, "member narrower than field");
+
+  static void decode (class_type& rec, const unsigned char* raw, string_table const& strings)
+  {
+    uint32_t value (0);
+    std::memcpy (&value, raw, bytes);
+    assign (rec, value, strings);
+  }
+
+  // value is the integer or, for strings, the offset into strings
+  static void assign (class_type& rec, uint32_t value, string_table const& strings)
+  {
+    if constexpr (is_string)
+    {
+      rec.*Member = member_type (strings.at (value));
+    }
+    else
+    {
+      rec.*Member = value;
+    }
+  }
+  // for strings stored in the record itself
+  static void assign_string (class_type& rec, std::string_view str)
+  {
+    if constexpr (is_string)
+    {
+      rec.*Member = member_type (str);
+    }
+  }
+
+  static void encode (class_type const& rec, unsigned char* raw, string_pool const& strings)
+  {
+    uint32_t value;
+    if constexpr (is_string)
+    {
+      value = strings.offset (rec.*Member);
+    }
+    else
+    {
+      value = uint32_t (rec.*Member);
+      if (bytes < 4 && (rec.*Member < 0 || value >> (8 * bytes)))
+      {
+        throw std::out_of_range
+          ( "value " + std::to_string (rec.*Member) + " does not fit "
+          + std::to_string (8 * bytes) + " bit field"
+          );
+      }
+    }
+    std::memcpy (raw, &value, bytes);
+  }
+
+  static void add_strings (class_type const& rec, string_pool& strings)
+  {
+    if constexpr (is_string)
+    {
+      strings.add (rec.*Member);
+    }
+  }
+};
+
+// the columns of a record in file order. the id is not one of them, it
+// lives in the id list. fields are packed without gaps and the record is
+// padded to the widest field, as the client does.
+template<typename... Fields>
+struct db2_fields
+{
+  static_assert (sizeof... (Fields) > 0, "records have at least one field");
+
+  static constexpr std::size_t count = sizeof... (Fields);
+
+  static constexpr std::array<std::size_t, count> widths()
+  {
+    return {Fields::bytes...};
+  }
+  static constexpr std::array<bool, count> strings()
+  {
+    return {Fields::is_string...};
+  }
+
+  static constexpr std::array<std::size_t, count + 1> offsets()
+  {
+    const std::size_t bytes[] = {Fields::bytes...};
+    std::array<std::size_t, count + 1> result {};
+    for (std::size_t i (0); i < count; ++i)
+    {
+      result[i + 1] = result[i] + bytes[i];
+    }
+    return result;
+  }
+
+  // size of a record holding only the first columns
+  static constexpr std::size_t record_size (std::size_t columns = count)
+  {
+    const std::size_t bytes[] = {Fields::bytes...};
+    std::size_t size (0);
+    std::size_t alignment (1);
+    for (std::size_t i (0); i < columns; ++i)
+    {
+      size += bytes[i];
+      alignment = std::max (alignment, bytes[i] == 3 ? std::size_t (4) : bytes[i]);
+    }
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  static constexpr std::array<uint16_t, 2 * count> layout()
+  {
+    const uint16_t sizes[] = {Fields::size...};
+    std::array<uint16_t, 2 * count> result {};
+    for (std::size_t i (0); i < count; ++i)
+    {
+      result[2 * i] = sizes[i];
+      result[2 * i + 1] = offsets()[i];
+    }
+    return result;
+  }
+
+  template<typename Rec>
+  static void decode (Rec& rec, const unsigned char* raw, string_table const& strings)
+  {
+    decode (rec, raw, strings, std::index_sequence_for<Fields...>());
+  }
+  template<typename Rec>
+  static void encode (Rec const& rec, unsigned char* raw, string_pool const& strings)
+  {
+    encode (rec, raw, strings, std::index_sequence_for<Fields...>());
+  }
+  template<typename Rec>
+  static void add_strings (Rec const& rec, string_pool& strings)
+  {
+    (Fields::add_strings (rec, strings), ...);
+  }
+  // sets the column with the given index, see db2_field::assign
+  template<typename Rec>
+  static void assign (Rec& rec, std::size_t column, uint32_t value, string_table const& strings)
+  {
+    std::size_t i (0);
+    ((i++ == column ? Fields::assign (rec, value, strings) : void()), ...);
+  }
+  template<typename Rec>
+  static void assign_string (Rec& rec, std::size_t column, std::string_view str)
+  {
+    std::size_t i (0);
+    ((i++ == column ? Fields::assign_string (rec, str) : void()), ...);
+  }
+
+private:
+  template<typename Rec, std::size_t... I>
+  static void decode (Rec& rec, const unsigned char* raw, string_table const& strings, std::index_sequence<I...>)
+  {
+    constexpr auto offset (offsets());
+    (Fields::decode (rec, raw + offset[I], strings), ...);
+  }
+  template<typename Rec, std::size_t... I>
+  static void encode (Rec const& rec, unsigned char* raw, string_pool const& strings, std::index_sequence<I...>)
+  {
+    constexpr auto offset (offsets());
+    (Fields::encode (rec, raw + offset[I], strings), ...);
+  }
+};
+
+template<std::size_t N>
+constexpr bool same_layout (std::array<uint16_t, N> const& lhs, std::array<uint16_t, N> const& rhs)
+{
+  for (std::size_t i (0); i < N; ++i)
+  {
+    if (lhs[i] != rhs[i]) return false;
+  }
+  return true;
+}
+
+// the raw record of a table, as found in the file. Rec is the owning
+// record, View the one decoded in place, which may be Rec itself. both
+// declare their columns as `fields`.
+template<typename Rec, typename View, uint32_t TableHash, uint32_t LayoutHash>
+struct db2_raw
+{
+  typedef typename Rec::fields fields;
+  typedef View view_type;
+
+  static_assert ( same_layout (fields::layout(), View::fields::layout())
+                , "record and view disagree on the layout"
+                );
+
+  static constexpr uint32_t table_hash = TableHash;
+  static constexpr uint32_t layout_hash = LayoutHash;
+  static constexpr uint32_t field_count = fields::count + 1;
+  static constexpr std::array<uint16_t, 2 * fields::count> field_layout = fields::layout();
+
+  unsigned char bytes[fields::record_size()];
+
+  view_type view (string_table const& strings, int id) const
+  {
+    view_type rec;
+    rec.id = id;
+    View::fields::decode (rec, bytes, strings);
+    return rec;
+  }
+  Rec unraw (DB2Header const&, string_table const& strings, int id) const
+  {
+    Rec rec;
+    rec.id = id;
+    fields::decode (rec, bytes, strings);
+    return rec;
+  }
+
+  // Row is Rec or View, both encode the same
+  template<typename Row>
+  static db2_raw encode (Row const& rec, string_pool const& strings)
+  {
+    static_assert (same_layout (fields::layout(), Row::fields::layout()), "not a row of this table");
+    db2_raw raw;
+    std::memset (raw.bytes, 0, sizeof (raw.bytes));
+    Row::fields::encode (rec, raw.bytes, strings);
+    return raw;
+  }
+  template<typename Row>
+  static void add_strings (Row const& rec, string_pool& strings)
+  {
+    Row::fields::add_strings (rec, strings);
+  }
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// 64 bit FNV-1a. stable across builds and platforms, so it can be
+// stored, unlike std::hash.
+inline uint64_t fnv1a (std::string_view data, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+  for (unsigned char c : data)
+  {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
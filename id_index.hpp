@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+// maps record ids to row numbers. ids of DB2 tables are usually dense,
+// so a flat table covering min_id..max_id is used unless the range is a
+// lot larger than the number of rows, in which case a hash map is used.
+class id_index
+{
+public:
+  static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+  id_index (int min_id, int max_id, std::size_t count)
+    : _min_id (min_id)
+    , _dense ( min_id <= max_id
+            && uint64_t (int64_t (max_id) - min_id) < 4 * uint64_t (count) + 1024
+             )
+  {
+    if (_dense)
+    {
+      _rows.assign (std::size_t (int64_t (max_id) - min_id + 1), npos);
+    }
+    else
+    {
+      _sparse_rows.reserve (count);
+    }
+  }
+
+  template<typename Records>
+    explicit id_index (Records const& records)
+      : id_index (min_id_of (records), max_id_of (records), records.size())
+  {
+    std::size_t row (0);
+    for (auto const& rec : records)
+    {
+      insert (rec.id, row++);
+    }
+  }
+
+  // ids outside of the range given on construction may only be
+  // inserted into sparse indices
+  void insert (int id, std::size_t row)
+  {
+    if (_dense)
+    {
+      _rows.at (std::size_t (int64_t (id) - _min_id)) = row;
+    }
+    else
+    {
+      _sparse_rows[id] = row;
+    }
+  }
+
+  std::size_t find (int id) const
+  {
+    if (_dense)
+    {
+      const uint64_t offset (uint64_t (int64_t (id) - _min_id));
+      return offset < _rows.size() ? _rows[offset] : npos;
+    }
+    const auto it (_sparse_rows.find (id));
+    return it != _sparse_rows.end() ? it->second : npos;
+  }
+
+private:
+  template<typename Records>
+    static int min_id_of (Records const& records)
+  {
+    int id (std::numeric_limits<int>::max());
+    for (auto const& rec : records)
+    {
+      id = std::min (id, rec.id);
+    }
+    return id;
+  }
+  template<typename Records>
+    static int max_id_of (Records const& records)
+  {
+    int id (std::numeric_limits<int>::min());
+    for (auto const& rec : records)
+    {
+      id = std::max (id, rec.id);
+    }
+    return id;
+  }
+
+  int _min_id;
+  bool _dense;
+  std::vector<std::size_t> _rows;
+  std::unordered_map<int, std::size_t> _sparse_rows;
+};
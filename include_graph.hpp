@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "id_index.hpp"
+#include "package_view.hpp"
+
+// the includes between packages, i.e. the d column of their members, in
+// memory: an order in which every package comes after the ones it
+// includes, the cycles that prevent one, and each package flattened,
+// with its includes replaced by the included packages' content,
+// recursively. packages are referred to by their index in the vector the
+// graph was built from, which has to outlive it.
+class include_graph
+{
+public:
+  explicit include_graph (std::vector<package_view> const& packages)
+    : _packages (packages)
+    , _by_id (packages)
+    , _includes (packages.size())
+    , _ordered (packages.size(), false)
+    , _flattened (packages.size())
+    , _is_flattened (packages.size(), false)
+  {
+    for (std::size_t p (0); p < packages.size(); ++p)
+    {
+      for (member_view const& member : packages[p].members)
+      {
+        if (member.include_id != 0)
+        {
+          const std::size_t included (_by_id.find (member.include_id));
+          if (included == id_index::npos)
+          {
+            _missing.emplace_back (p, member.include_id);
+          }
+          else
+          {
+            _includes[p].push_back (included);
+          }
+        }
+      }
+    }
+    sort_topologically();
+    find_cycles();
+  }
+
+  // included before including. packages in a cycle, or including one
+  // directly or indirectly, are left out.
+  std::vector<std::size_t> const& order() const
+  {
+    return _order;
+  }
+  bool ordered (std::size_t package) const
+  {
+    return _ordered[package];
+  }
+
+  // one cycle per group of packages that include each other, each as the
+  // packages along it
+  std::vector<std::vector<std::size_t>> const& cycles() const
+  {
+    return _cycles;
+  }
+
+  // includes of packages that do not exist: the including package and
+  // the included id. they are left out when flattening.
+  std::vector<std::pair<std::size_t, int>> const& missing() const
+  {
+    return _missing;
+  }
+
+  // the content of package with its members in sequence order and
+  // includes expanded, as views into whatever the packages view. computed
+  // on first use and kept, so that a package included by many is only
+  // expanded once. members that do not end in a newline get one, so
+  // that the last line of one does not run into the first of the next.
+  content_pieces const& flattened (std::size_t package)
+  {
+    if (!_ordered[package])
+    {
+      throw std::invalid_argument
+        ("package " + std::to_string (_packages[package].id) + " is in or includes an include cycle");
+    }
+
+    // included packages are flattened first. the packages reachable from
+    // an ordered one are ordered too, so this terminates.
+    std::vector<std::size_t> pending (1, package);
+    while (!pending.empty())
+    {
+      const std::size_t p (pending.back());
+      if (_is_flattened[p])
+      {
+        pending.pop_back();
+        continue;
+      }
+      bool ready (true);
+      for (std::size_t included : _includes[p])
+      {
+        if (!_is_flattened[included])
+        {
+          pending.push_back (included);
+          ready = false;
+        }
+      }
+      if (ready)
+      {
+        flatten (p);
+        pending.pop_back();
+      }
+    }
+    return _flattened[package];
+  }
+
+private:
+  // Kahn's algorithm on the include edges: a package is ready once all
+  // packages it includes are
+  void sort_topologically()
+  {
+    std::vector<std::size_t> pending_includes (_packages.size());
+    std::vector<std::vector<std::size_t>> included_by (_packages.size());
+    for (std::size_t p (0); p < _packages.size(); ++p)
+    {
+      pending_includes[p] = _includes[p].size();
+      for (std::size_t included : _includes[p])
+      {
+        included_by[included].push_back (p);
+      }
+    }
+
+    for (std::size_t p (0); p < _packages.size(); ++p)
+    {
+      if (pending_includes[p] == 0)
+      {
+        _order.push_back (p);
+      }
+    }
+    for (std::size_t next (0); next < _order.size(); ++next)
+    {
+      _ordered[_order[next]] = true;
+      for (std::size_t includer : included_by[_order[next]])
+      {
+        if (--pending_includes[includer] == 0)
+        {
+          _order.push_back (includer);
+        }
+      }
+    }
+  }
+
+  // every package left out of the order includes at least one other left
+  // out package, so following those from any of them ends in a cycle
+  void find_cycles()
+  {
+    enum { unvisited, on_path, visited };
+    std::vector<char> state (_packages.size(), unvisited);
+    for (std::size_t start (0); start < _packages.size(); ++start)
+    {
+      if (_ordered[start] || state[start] != unvisited)
+      {
+        continue;
+      }
+      std::vector<std::size_t> path;
+      std::size_t p (start);
+      while (state[p] == unvisited)
+      {
+        state[p] = on_path;
+        path.push_back (p);
+        p = *std::find_if ( _includes[p].begin(), _includes[p].end()
+                          , [&] (std::size_t included) { return !_ordered[included]; }
+                          );
+      }
+      if (state[p] == on_path)
+      {
+        _cycles.emplace_back (std::find (path.begin(), path.end(), p), path.end());
+      }
+      for (std::size_t on : path)
+      {
+        state[on] = visited;
+      }
+    }
+  }
+
+  void flatten (std::size_t package)
+  {
+    std::vector<member_view const*> members;
+    for (member_view const& member : _packages[package].members)
+    {
+      members.push_back (&member);
+    }
+    std::stable_sort ( members.begin(), members.end()
+                     , [] (member_view const* lhs, member_view const* rhs)
+                       {
+                         return lhs->sequence < rhs->sequence;
+                       }
+                     );
+
+    content_pieces& flattened (_flattened[package]);
+    for (member_view const* member : members)
+    {
+      if (member->include_id == 0)
+      {
+        flattened.insert (flattened.end(), member->content.begin(), member->content.end());
+      }
+      else
+      {
+        const std::size_t included (_by_id.find (member->include_id));
+        if (included != id_index::npos)
+        {
+          content_pieces const& pieces (_flattened[included]);
+          flattened.insert (flattened.end(), pieces.begin(), pieces.end());
+        }
+      }
+      const auto last
+        ( std::find_if ( flattened.rbegin(), flattened.rend()
+                       , [] (std::string_view piece) { return !piece.empty(); }
+                       )
+        );
+      if (last != flattened.rend() && last->back() != '\n')
+      {
+        flattened.push_back ("\n");
+      }
+    }
+    _is_flattened[package] = true;
+  }
+
+  std::vector<package_view> const& _packages;
+  id_index _by_id;
+  std::vector<std::vector<std::size_t>> _includes;
+  std::vector<std::size_t> _order;
+  std::vector<bool> _ordered;
+  std::vector<std::vector<std::size_t>> _cycles;
+  std::vector<std::pair<std::size_t, int>> _missing;
+  std::vector<content_pieces> _flattened;
+  std::vector<bool> _is_flattened;
+};
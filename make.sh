@@ -1,3 +1,5 @@
 #!/bin/bash
-clang++ reader.cpp  -o reader -I $BOOST_ROOT/include/ --std=c++11 -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system
-clang++ writer.cpp  -o writer -I $BOOST_ROOT/include/ --std=c++11 -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system
+clang++ reader.cpp  -o reader -I $BOOST_ROOT/include/ --std=c++17 -pthread -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system
+clang++ writer.cpp  -o writer -I $BOOST_ROOT/include/ --std=c++17 -pthread -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system
+clang++ patcher.cpp -o patcher -I $BOOST_ROOT/include/ --std=c++17 -pthread -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system
+clang++ bench.cpp   -o bench   -I $BOOST_ROOT/include/ --std=c++17 -pthread -lboost_filesystem -L $BOOST_ROOT/lib/ -lboost_system -O2
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// what the writer knew about a member when it last wrote the DB2s: the
+// file it came from, what of it was saved, which differs from the file
+// if it was compacted, and the ids it was given
+struct manifest_entry_t
+{
+  int package;
+  int sequence;
+  int member_id;
+  uintmax_t size;
+  int64_t mtime;
+  uint64_t hash;
+  uintmax_t saved_size;
+  uint64_t saved_hash;
+  std::vector<int> script_ids;
+  std::string name;
+};
+
+// sorted by package id and sequence
+typedef std::vector<manifest_entry_t> manifest_t;
+
+inline bool manifest_order (manifest_entry_t const& lhs, manifest_entry_t const& rhs)
+{
+  return std::tie (lhs.package, lhs.sequence) < std::tie (rhs.package, rhs.sequence);
+}
+
+inline void sort_manifest (manifest_t& manifest)
+{
+  std::stable_sort (manifest.begin(), manifest.end(), manifest_order);
+}
+
+// the entry of a member or nullptr. of entries with the same key, the
+// first one added.
+inline manifest_entry_t const* find_manifest_entry (manifest_t const& manifest, int package, int sequence)
+{
+  manifest_entry_t key;
+  key.package = package;
+  key.sequence = sequence;
+  const auto entry (std::lower_bound (manifest.begin(), manifest.end(), key, manifest_order));
+  if (entry == manifest.end() || entry->package != package || entry->sequence != sequence)
+  {
+    return nullptr;
+  }
+  return &*entry;
+}
+
+// one line per member:
+//   <package> <sequence> <member id> <size> <mtime> <hash> <saved size> <saved hash> <n> <n script ids> <name>
+// the mtime is in nanoseconds since the epoch. the name comes last as it
+// may contain spaces. version 1 lacked the saved size and hash, which are
+// taken to be those of the file.
+inline manifest_t read_manifest (const boost::filesystem::path filename)
+{
+  manifest_t manifest;
+  std::ifstream stream (filename.string());
+  std::string line;
+  if (!std::getline (stream, line))
+  {
+    return manifest;
+  }
+  const bool has_saved (line == "scene_scripts manifest 2");
+  if (!has_saved && line != "scene_scripts manifest 1")
+  {
+    throw std::invalid_argument ("unknown manifest version: " + filename.string());
+  }
+
+  while (std::getline (stream, line))
+  {
+    std::istringstream fields (line);
+    std::size_t script_count;
+    manifest_entry_t entry;
+    fields >> entry.package >> entry.sequence >> entry.member_id >> entry.size >> entry.mtime >> entry.hash;
+    if (has_saved)
+    {
+      fields >> entry.saved_size >> entry.saved_hash;
+    }
+    else
+    {
+      entry.saved_size = entry.size;
+      entry.saved_hash = entry.hash;
+    }
+    fields >> script_count;
+    entry.script_ids.resize (script_count);
+    for (int& script_id : entry.script_ids)
+    {
+      fields >> script_id;
+    }
+    if (!fields || fields.get() != ' ')
+    {
+      throw std::invalid_argument ("bad manifest line: " + line);
+    }
+    std::getline (fields, entry.name);
+    manifest.push_back (std::move (entry));
+  }
+
+  sort_manifest (manifest);
+  return manifest;
+}
+
+inline void write_manifest (const boost::filesystem::path filename, manifest_t const& manifest)
+{
+  std::ofstream stream (filename.string());
+  stream << "scene_scripts manifest 2\n";
+  for (manifest_entry_t const& entry : manifest)
+  {
+    stream << entry.package << ' ' << entry.sequence << ' ' << entry.member_id
+           << ' ' << entry.size << ' ' << entry.mtime << ' ' << entry.hash
+           << ' ' << entry.saved_size << ' ' << entry.saved_hash
+           << ' ' << entry.script_ids.size();
+    for (int script_id : entry.script_ids)
+    {
+      stream << ' ' << script_id;
+    }
+    stream << ' ' << entry.name << '\n';
+  }
+  if (!stream.flush())
+  {
+    throw std::runtime_error ("file not written: " + filename.string());
+  }
+}
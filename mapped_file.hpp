@@ -0,0 +1,62 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// read-only mapping of a whole file. empty files are valid and map to
+// an empty range, since mapped_region refuses zero-sized mappings.
+class mapped_file
+{
+public:
+  explicit mapped_file (const std::string& filename)
+  {
+    boost::system::error_code ec;
+    const boost::uintmax_t size (boost::filesystem::file_size (filename, ec));
+    if (ec)
+    {
+      throw std::runtime_error ("file not opened: " + filename);
+    }
+    if (size == 0)
+    {
+      return;
+    }
+
+    try
+    {
+      boost::interprocess::file_mapping mapping
+        (filename.c_str(), boost::interprocess::read_only);
+      boost::interprocess::mapped_region region
+        (mapping, boost::interprocess::read_only);
+      _region.swap (region);
+    }
+    catch (boost::interprocess::interprocess_exception const&)
+    {
+      throw std::runtime_error ("file not opened: " + filename);
+    }
+  }
+
+  mapped_file (mapped_file const&) = delete;
+  mapped_file& operator= (mapped_file const&) = delete;
+
+  const char* data() const
+  {
+    return static_cast<const char*> (_region.get_address());
+  }
+  std::size_t size() const
+  {
+    return _region.get_size();
+  }
+  std::string_view view() const
+  {
+    return {data(), size()};
+  }
+
+private:
+  boost::interprocess::mapped_region _region;
+};
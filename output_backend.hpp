@@ -0,0 +1,683 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined (__linux__) && __has_include (<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include "package_view.hpp"
+#include "parallel.hpp"
+
+// creating a tree of many small files and links. directories are kept
+// open and entries are made relative to them, so the kernel does not
+// resolve the whole path for every one. what to change is decided up
+// front with the read-only checks below, the changes are then handed to
+// an output_backend in batches: a thread pool or io_uring.
+
+// an open directory, for making entries in it
+class directory
+{
+public:
+  // an existing directory
+  explicit directory (std::string path)
+    : _fd (open (AT_FDCWD, path))
+    , _path (std::move (path))
+  {}
+  // a subdirectory, created if it does not exist
+  directory (directory const& parent, std::string const& name)
+    : _path (parent._path + "/" + name)
+  {
+    if (::mkdirat (parent._fd, name.c_str(), 0777) != 0 && errno != EEXIST)
+    {
+      throw std::runtime_error ("directory not created: " + _path);
+    }
+    _fd = open (parent._fd, name);
+  }
+  ~directory()
+  {
+    ::close (_fd);
+  }
+
+  directory (directory const&) = delete;
+  directory& operator= (directory const&) = delete;
+
+  int fd() const
+  {
+    return _fd;
+  }
+  std::string const& path() const
+  {
+    return _path;
+  }
+
+private:
+  int open (int parent, std::string const& name) const
+  {
+    const int fd (::openat (parent, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd < 0)
+    {
+      throw std::runtime_error ("directory not opened: " + _path);
+    }
+    return fd;
+  }
+
+  int _fd;
+  std::string _path;
+};
+
+inline void write_pieces (int fd, content_pieces content)
+{
+  std::vector<iovec> iov;
+  for (auto piece (content.begin()); piece != content.end();)
+  {
+    iov.clear();
+    for (auto it (piece); it != content.end() && iov.size() < IOV_MAX; ++it)
+    {
+      iov.push_back ({const_cast<char*> (it->data()), it->size()});
+    }
+
+    const ssize_t written (::writev (fd, iov.data(), iov.size()));
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::runtime_error ("writev failed");
+    }
+
+    for (std::size_t remaining (written); remaining;)
+    {
+      const std::size_t consumed (std::min (remaining, piece->size()));
+      piece->remove_prefix (consumed);
+      remaining -= consumed;
+      if (piece->empty())
+      {
+        ++piece;
+      }
+    }
+    while (piece != content.end() && piece->empty())
+    {
+      ++piece;
+    }
+  }
+}
+
+inline std::size_t content_size (content_pieces const& content)
+{
+  std::size_t size (0);
+  for (std::string_view piece : content)
+  {
+    size += piece.size();
+  }
+  return size;
+}
+
+enum class file_state
+{
+  missing,
+  different,
+  same,
+};
+
+// whether name in dir is a regular file holding exactly content
+inline file_state compare_file (directory const& dir, std::string const& name, content_pieces const& content)
+{
+  struct stat status;
+  if (::fstatat (dir.fd(), name.c_str(), &status, AT_SYMLINK_NOFOLLOW) != 0)
+  {
+    return errno == ENOENT ? file_state::missing : file_state::different;
+  }
+  const std::size_t size (content_size (content));
+  if (!S_ISREG (status.st_mode) || std::size_t (status.st_size) != size)
+  {
+    return file_state::different;
+  }
+  if (size == 0)
+  {
+    return file_state::same;
+  }
+
+  const int fd (::openat (dir.fd(), name.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+  {
+    return file_state::different;
+  }
+  void* const mapping (::mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+  ::close (fd);
+  if (mapping == MAP_FAILED)
+  {
+    return file_state::different;
+  }
+  const char* existing (static_cast<const char*> (mapping));
+  file_state state (file_state::same);
+  for (std::string_view piece : content)
+  {
+    if (std::memcmp (existing, piece.data(), piece.size()) != 0)
+    {
+      state = file_state::different;
+      break;
+    }
+    existing += piece.size();
+  }
+  ::munmap (mapping, size);
+  return state;
+}
+
+// whether name in dir is a symlink to target, or missing
+inline file_state compare_symlink (directory const& dir, std::string const& name, std::string const& target)
+{
+  std::vector<char> buffer (target.size() + 1);
+  const ssize_t length (::readlinkat (dir.fd(), name.c_str(), buffer.data(), buffer.size()));
+  if (length < 0)
+  {
+    return errno == ENOENT ? file_state::missing : file_state::different;
+  }
+  return std::string_view (buffer.data(), length) == target ? file_state::same : file_state::different;
+}
+
+// removes name from dir, whatever it is
+inline void remove_entry (directory const& dir, std::string const& name)
+{
+  struct stat status;
+  if (::fstatat (dir.fd(), name.c_str(), &status, AT_SYMLINK_NOFOLLOW) != 0)
+  {
+    return;
+  }
+  if (S_ISDIR (status.st_mode))
+  {
+    boost::filesystem::remove_all (dir.path() + "/" + name);
+  }
+  else if (::unlinkat (dir.fd(), name.c_str(), 0) != 0)
+  {
+    throw std::runtime_error ("not removed: " + dir.path() + "/" + name);
+  }
+}
+
+// an entry to create in dir, which has to stay open until the backend
+// ran it: a file with content or a symlink to target, where name must
+// not exist unless replace is set. a file that replaces one is written
+// to a temporary name and renamed over it, so that readers never see it
+// partially written. a symlink that replaces something is made right
+// after removing it.
+struct output_op
+{
+  directory const* dir;
+  std::string name;
+  bool symlink;
+  content_pieces content;
+  bool replace;
+  std::string target;
+};
+
+class output_backend
+{
+public:
+  virtual ~output_backend() = default;
+
+  // runs all ops, in any order, and throws if one fails
+  virtual void run (std::vector<output_op> const& ops) = 0;
+  virtual const char* name() const = 0;
+
+protected:
+  static std::string temporary_name (std::string const& name)
+  {
+    return "." + name + ".tmp";
+  }
+
+  static void run_one (output_op const& op)
+  {
+    if (op.symlink)
+    {
+      if (op.replace)
+      {
+        remove_entry (*op.dir, op.name);
+      }
+      if (::symlinkat (op.target.c_str(), op.dir->fd(), op.name.c_str()) != 0)
+      {
+        throw std::runtime_error ("symlink not created: " + op.dir->path() + "/" + op.name);
+      }
+      return;
+    }
+
+    const std::string temporary (op.replace ? temporary_name (op.name) : op.name);
+    const int fd (::openat (op.dir->fd(), temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (fd < 0)
+    {
+      throw std::runtime_error ("file not opened: " + op.dir->path() + "/" + temporary);
+    }
+    bool written (true);
+    try
+    {
+      write_pieces (fd, op.content);
+    }
+    catch (...)
+    {
+      written = false;
+    }
+    if (::close (fd) != 0 || !written)
+    {
+      ::unlinkat (op.dir->fd(), temporary.c_str(), 0);
+      throw std::runtime_error ("file not written: " + op.dir->path() + "/" + temporary);
+    }
+    if (op.replace && ::renameat (op.dir->fd(), temporary.c_str(), op.dir->fd(), op.name.c_str()) != 0)
+    {
+      throw std::runtime_error ("file not renamed: " + op.dir->path() + "/" + op.name);
+    }
+  }
+};
+
+// each op with plain syscalls, spread over jobs threads
+class thread_pool_backend : public output_backend
+{
+public:
+  explicit thread_pool_backend (std::size_t jobs)
+    : _jobs (jobs)
+  {}
+
+  void run (std::vector<output_op> const& ops) override
+  {
+    parallel_for (_jobs, ops.size(), [&] (std::size_t i)
+      {
+        run_one (ops[i]);
+      }
+    );
+  }
+  const char* name() const override
+  {
+    return "threads";
+  }
+
+private:
+  std::size_t _jobs;
+};
+
+#if defined (__linux__) && __has_include (<linux/io_uring.h>)
+
+// ops as linked chains on one io_uring, submitted a ring full at a time:
+// a file is openat into a registered file slot, writev and close, plus
+// renameat if it replaces one, a symlink is symlinkat, after unlinkat if
+// it replaces something. a chain that fails, e.g. on a short write or
+// as a directory is in the way, is redone with plain syscalls. talks to the kernel
+// directly, without liburing.
+class io_uring_backend : public output_backend
+{
+public:
+  // nullptr if the kernel has no io_uring or lacks one of the operations
+  // used (before 5.15), or it is disabled
+  static std::unique_ptr<io_uring_backend> create (unsigned entries = 1024)
+  {
+    std::unique_ptr<io_uring_backend> backend (new io_uring_backend());
+    if (!backend->setup (entries))
+    {
+      return nullptr;
+    }
+    return backend;
+  }
+
+  ~io_uring_backend() override
+  {
+    if (_sqes != MAP_FAILED)
+    {
+      ::munmap (_sqes, _sqes_size);
+    }
+    if (_ring != MAP_FAILED)
+    {
+      ::munmap (_ring, _ring_size);
+    }
+    if (_fd >= 0)
+    {
+      ::close (_fd);
+    }
+  }
+
+  void run (std::vector<output_op> const& ops) override
+  {
+    std::vector<std::string> temporaries (ops.size());
+    for (std::size_t i (0); i < ops.size(); ++i)
+    {
+      if (!ops[i].symlink && ops[i].replace)
+      {
+        temporaries[i] = temporary_name (ops[i].name);
+      }
+    }
+
+    std::vector<std::size_t> failed;
+    for (std::size_t begin (0); begin < ops.size();)
+    {
+      // as many whole chains as fit the ring and the file slots
+      std::size_t end (begin);
+      std::size_t sqes (0);
+      std::size_t iovecs (0);
+      std::size_t slots (0);
+      while (end < ops.size())
+      {
+        const std::size_t writes (ops[end].symlink ? 0 : write_count (ops[end].content));
+        const std::size_t chain ((ops[end].symlink ? 1 : 2 + writes) + ops[end].replace);
+        if (chain > _entries)
+        {
+          failed.push_back (end++);
+          continue;
+        }
+        if (sqes + chain > _entries || slots + !ops[end].symlink > _slots)
+        {
+          break;
+        }
+        sqes += chain;
+        iovecs += ops[end].content.size();
+        slots += !ops[end].symlink;
+        ++end;
+      }
+
+      // what each completion belongs to. iovecs are not moved until the
+      // batch is done.
+      std::vector<iovec> iov;
+      iov.reserve (iovecs);
+      std::vector<completion> completions;
+      completions.reserve (sqes);
+      unsigned slot (0);
+      for (std::size_t i (begin); i < end; ++i)
+      {
+        output_op const& op (ops[i]);
+        if (op.symlink)
+        {
+          if (op.replace)
+          {
+            io_uring_sqe& unlink (next_sqe());
+            unlink.opcode = IORING_OP_UNLINKAT;
+            unlink.flags = IOSQE_IO_LINK;
+            unlink.fd = op.dir->fd();
+            unlink.addr = reinterpret_cast<uintptr_t> (op.name.c_str());
+            unlink.user_data = completions.size();
+            completions.push_back ({i, 0, 0});
+          }
+          io_uring_sqe& symlink (next_sqe());
+          symlink.opcode = IORING_OP_SYMLINKAT;
+          symlink.fd = op.dir->fd();
+          symlink.addr = reinterpret_cast<uintptr_t> (op.target.c_str());
+          symlink.addr2 = reinterpret_cast<uintptr_t> (op.name.c_str());
+          symlink.user_data = completions.size();
+          completions.push_back ({i, 0, 0});
+          continue;
+        }
+
+        io_uring_sqe& open (next_sqe());
+        open.opcode = IORING_OP_OPENAT;
+        open.flags = IOSQE_IO_LINK;
+        open.fd = op.dir->fd();
+        open.addr = reinterpret_cast<uintptr_t> ((op.replace ? temporaries[i] : op.name).c_str());
+        open.len = 0666;
+        open.open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        open.file_index = slot + 1;
+        open.user_data = completions.size();
+        completions.push_back ({i, slot, 0});
+
+        uint64_t offset (0);
+        for (std::size_t piece (0); piece < op.content.size(); piece += IOV_MAX)
+        {
+          const std::size_t first_iovec (iov.size());
+          std::size_t bytes (0);
+          for (std::size_t p (piece); p < std::min (op.content.size(), piece + IOV_MAX); ++p)
+          {
+            iov.push_back ({const_cast<char*> (op.content[p].data()), op.content[p].size()});
+            bytes += op.content[p].size();
+          }
+          io_uring_sqe& write (next_sqe());
+          write.opcode = IORING_OP_WRITEV;
+          write.flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+          write.fd = slot;
+          write.addr = reinterpret_cast<uintptr_t> (iov.data() + first_iovec);
+          write.len = iov.size() - first_iovec;
+          write.off = offset;
+          write.user_data = completions.size();
+          completions.push_back ({i, slot, bytes});
+          offset += bytes;
+        }
+
+        io_uring_sqe& close (next_sqe());
+        close.opcode = IORING_OP_CLOSE;
+        close.flags = op.replace ? IOSQE_IO_LINK : 0;
+        close.file_index = slot + 1;
+        close.user_data = completions.size();
+        completions.push_back ({i, slot, 0});
+        if (!op.replace)
+        {
+          ++slot;
+          continue;
+        }
+
+        io_uring_sqe& rename (next_sqe());
+        rename.opcode = IORING_OP_RENAMEAT;
+        rename.fd = op.dir->fd();
+        rename.addr = reinterpret_cast<uintptr_t> (temporaries[i].c_str());
+        rename.len = op.dir->fd();
+        rename.addr2 = reinterpret_cast<uintptr_t> (op.name.c_str());
+        rename.user_data = completions.size();
+        completions.push_back ({i, slot, 0});
+
+        ++slot;
+      }
+
+      std::vector<completion const*> failed_in_batch;
+      submit_and_wait (completions.size(), [&] (io_uring_cqe const& cqe)
+        {
+          completion const& done (completions[cqe.user_data]);
+          if (cqe.res < 0 || std::size_t (cqe.res) < done.bytes)
+          {
+            failed_in_batch.push_back (&done);
+          }
+        }
+      );
+      // a file stays open in its slot when its close was cancelled
+      for (completion const* done : failed_in_batch)
+      {
+        if (!ops[done->op].symlink)
+        {
+          clear_slot (done->slot);
+        }
+        failed.push_back (done->op);
+      }
+
+      begin = end;
+    }
+
+    std::sort (failed.begin(), failed.end());
+    failed.erase (std::unique (failed.begin(), failed.end()), failed.end());
+    for (std::size_t i : failed)
+    {
+      run_one (ops[i]);
+    }
+  }
+  const char* name() const override
+  {
+    return "io_uring";
+  }
+
+private:
+  struct completion
+  {
+    std::size_t op;
+    unsigned slot;
+    // for writes, the bytes expected to be written
+    std::size_t bytes;
+  };
+
+  io_uring_backend()
+    : _fd (-1)
+    , _ring (MAP_FAILED)
+    , _sqes (MAP_FAILED)
+  {}
+
+  static std::size_t write_count (content_pieces const& content)
+  {
+    return (content.size() + IOV_MAX - 1) / IOV_MAX;
+  }
+
+  int register_op (unsigned opcode, void* arg, unsigned count)
+  {
+    return ::syscall (__NR_io_uring_register, _fd, opcode, arg, count);
+  }
+
+  bool setup (unsigned entries)
+  {
+    io_uring_params params;
+    std::memset (&params, 0, sizeof (params));
+    _fd = ::syscall (__NR_io_uring_setup, entries, &params);
+    if (_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+      return false;
+    }
+    _entries = params.sq_entries;
+
+    // one mapping for both rings
+    _ring_size = std::max ( params.sq_off.array + params.sq_entries * sizeof (unsigned)
+                          , params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe)
+                          );
+    _ring = ::mmap (nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    _sqes_size = params.sq_entries * sizeof (io_uring_sqe);
+    _sqes = ::mmap (nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_ring == MAP_FAILED || _sqes == MAP_FAILED)
+    {
+      return false;
+    }
+    char* const ring (static_cast<char*> (_ring));
+    _sq_tail = reinterpret_cast<unsigned*> (ring + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned*> (ring + params.sq_off.ring_mask);
+    unsigned* const sq_array (reinterpret_cast<unsigned*> (ring + params.sq_off.array));
+    for (unsigned i (0); i < params.sq_entries; ++i)
+    {
+      sq_array[i] = i;
+    }
+    _cq_head = reinterpret_cast<unsigned*> (ring + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*> (ring + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned*> (ring + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*> (ring + params.cq_off.cqes);
+
+    const unsigned needed[] = { IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_CLOSE
+                              , IORING_OP_RENAMEAT, IORING_OP_SYMLINKAT, IORING_OP_UNLINKAT
+                              };
+    std::vector<unsigned char> probe_buffer (sizeof (io_uring_probe) + 256 * sizeof (io_uring_probe_op), 0);
+    io_uring_probe* const probe (reinterpret_cast<io_uring_probe*> (probe_buffer.data()));
+    if (register_op (IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+      return false;
+    }
+    for (unsigned op : needed)
+    {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+      {
+        return false;
+      }
+    }
+
+    // a file takes at least three entries
+    _slots = std::max (1U, _entries / 3);
+    std::vector<int> empty (_slots, -1);
+    return register_op (IORING_REGISTER_FILES, empty.data(), _slots) >= 0;
+  }
+
+  io_uring_sqe& next_sqe()
+  {
+    io_uring_sqe& sqe (static_cast<io_uring_sqe*> (_sqes)[_sq_pending++ & _sq_mask]);
+    std::memset (&sqe, 0, sizeof (sqe));
+    return sqe;
+  }
+
+  // closes whatever file is left in slot
+  void clear_slot (unsigned slot)
+  {
+    int none (-1);
+    io_uring_files_update update;
+    std::memset (&update, 0, sizeof (update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uintptr_t> (&none);
+    register_op (IORING_REGISTER_FILES_UPDATE, &update, 1);
+  }
+
+  // publishes the count queued sqes and calls f for each of their
+  // completions
+  template<typename F>
+  void submit_and_wait (std::size_t count, F const& f)
+  {
+    __atomic_store_n (_sq_tail, _sq_pending, __ATOMIC_RELEASE);
+    std::size_t to_submit (count);
+    for (std::size_t completed (0); completed < count;)
+    {
+      const int submitted
+        (::syscall (__NR_io_uring_enter, _fd, unsigned (to_submit), 1U, IORING_ENTER_GETEVENTS, nullptr, 0));
+      if (submitted < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        {
+          continue;
+        }
+        throw std::runtime_error ("io_uring_enter failed: " + std::string (std::strerror (errno)));
+      }
+      to_submit -= submitted;
+
+      unsigned head (*_cq_head);
+      const unsigned tail (__atomic_load_n (_cq_tail, __ATOMIC_ACQUIRE));
+      for (; head != tail; ++head, ++completed)
+      {
+        f (_cqes[head & _cq_mask]);
+      }
+      __atomic_store_n (_cq_head, head, __ATOMIC_RELEASE);
+    }
+  }
+
+  int _fd;
+  unsigned _entries = 0;
+  unsigned _slots = 0;
+  void* _ring;
+  std::size_t _ring_size = 0;
+  void* _sqes;
+  std::size_t _sqes_size = 0;
+  unsigned* _sq_tail = nullptr;
+  unsigned _sq_mask = 0;
+  unsigned _sq_pending = 0;
+  unsigned* _cq_head = nullptr;
+  unsigned* _cq_tail = nullptr;
+  unsigned _cq_mask = 0;
+  io_uring_cqe* _cqes = nullptr;
+};
+
+#endif
+
+// io_uring if wanted and available, the thread pool otherwise. the
+// thread pool is the default: openat, renameat and symlinkat always run
+// on io_uring's own workers, which costs more than it saves on small
+// files, so io_uring only pays off where single syscalls are slow.
+inline std::unique_ptr<output_backend> make_output_backend (std::size_t jobs, bool io_uring)
+{
+#if defined (__linux__) && __has_include (<linux/io_uring.h>)
+  if (io_uring)
+  {
+    if (std::unique_ptr<io_uring_backend> backend = io_uring_backend::create())
+    {
+      return backend;
+    }
+  }
+#else
+  (void) io_uring;
+#endif
+  return std::unique_ptr<output_backend> (new thread_pool_backend (jobs));
+}
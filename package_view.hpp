@@ -0,0 +1,108 @@
+#pragma once
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "id_index.hpp"
+#include "structures.hpp"
+
+// file contents are given as pieces, e.g. the chunks of a script as
+// views into a string table, and written with one writev per file.
+typedef std::vector<std::string_view> content_pieces;
+
+// a package with all of its members, as views into whatever it was
+// loaded from: DB2 string tables, an archive or the writer's model.
+struct member_view
+{
+  int sequence;
+  std::string_view name;
+  int include_id;
+  content_pieces content;
+  // ids in the tables it was loaded from, if it was
+  int id;
+  std::vector<int> script_ids;
+};
+
+struct package_view
+{
+  int id;
+  std::string_view name;
+  std::vector<member_view> members;
+};
+
+// gathers members and script chains of the decoded tables into packages,
+// in table order. the views point into the tables' string blocks.
+inline std::vector<package_view> packages_from_tables
+  ( std::vector<SceneScriptRecView> const& scene_script_records
+  , std::vector<SceneScriptPackageRecView> const& scene_script_package_records
+  , std::vector<SceneScriptPackageMemberRec> const& scene_script_package_member_records
+  )
+{
+  const id_index scene_script_records_by_id (scene_script_records);
+  const id_index scene_script_package_records_by_id (scene_script_package_records);
+
+  std::vector<package_view> packages (scene_script_package_records.size());
+  for (std::size_t i (0); i < packages.size(); ++i)
+  {
+    packages[i].id = scene_script_package_records[i].id;
+    packages[i].name = scene_script_package_records[i].name;
+  }
+
+  for (SceneScriptPackageMemberRec const& rec : scene_script_package_member_records)
+  {
+    const std::size_t package (scene_script_package_records_by_id.find (rec.package));
+    if (package == id_index::npos)
+    {
+      std::cerr << rec.id << ": unknown package " << rec.package << "\n";
+      continue;
+    }
+
+    member_view member;
+    member.sequence = rec.sequence;
+    member.include_id = 0;
+    member.id = rec.id;
+    if (rec.script != 0)
+    {
+      for (int next_script = rec.script; next_script != 0;)
+      {
+        const std::size_t row (scene_script_records_by_id.find (next_script));
+        if (row == id_index::npos)
+        {
+          throw std::out_of_range ("unknown script " + std::to_string (next_script));
+        }
+        SceneScriptRecView const& script_rec (scene_script_records[row]);
+        if (member.name.empty())
+        {
+          member.name = script_rec.name;
+        }
+        member.content.push_back (script_rec.content);
+        member.script_ids.push_back (script_rec.id);
+        next_script = script_rec.next_script;
+        if (member.content.size() > scene_script_records.size())
+        {
+          throw std::invalid_argument ("script " + std::to_string (rec.script) + " loops");
+        }
+      }
+    }
+    else if (rec.d != 0)
+    {
+      member.include_id = rec.d;
+      const std::size_t included_package (scene_script_package_records_by_id.find (rec.d));
+      if (included_package != id_index::npos)
+      {
+        member.name = scene_script_package_records[included_package].name;
+      }
+    }
+    else
+    {
+      std::cerr << rec.id << ": neither script nor include\n";
+      continue;
+    }
+    packages[package].members.push_back (member);
+  }
+
+  return packages;
+}
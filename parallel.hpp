@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// calls f (i) for every i in [0, count) on up to jobs threads, the
+// calling one included. indices are handed out one at a time, so uneven
+// work balances itself. jobs == 0 means one thread per core. the first
+// exception thrown by f stops handing out indices and is rethrown.
+template<typename F>
+void parallel_for (std::size_t jobs, std::size_t count, F const& f)
+{
+  if (jobs == 0)
+  {
+    jobs = std::max (1U, std::thread::hardware_concurrency());
+  }
+  jobs = std::min (jobs, count);
+
+  std::atomic<std::size_t> next (0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  const auto worker
+    ( [&]
+      {
+        for (std::size_t i; (i = next++) < count;)
+        {
+          try
+          {
+            f (i);
+          }
+          catch (...)
+          {
+            std::lock_guard<std::mutex> const lock (error_mutex);
+            if (!error)
+            {
+              error = std::current_exception();
+            }
+            next = count;
+          }
+        }
+      }
+    );
+
+  std::vector<std::thread> threads;
+  for (std::size_t i (1); i < jobs; ++i)
+  {
+    threads.emplace_back (worker);
+  }
+  worker();
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  if (error)
+  {
+    std::rethrow_exception (error);
+  }
+}
@@ -0,0 +1,132 @@
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "scene_script_database.hpp"
+
+// applies a patch file to database. one command per line, '#' starts a
+// comment, names extend to the end of the line:
+//   add-package <id> <name>
+//   remove-package <id>
+//   remove-member <package> <sequence>
+//   script <package> <sequence> <file> <name>
+//   replace <package> <sequence> <file>
+//   include <package> <sequence> <included package>
+// files are relative to the patch file.
+void apply_patch (SceneScriptDatabase& database, const boost::filesystem::path patch_filename)
+{
+  std::ifstream patch (patch_filename.string());
+  if (!patch)
+  {
+    throw std::runtime_error ("file not opened: " + patch_filename.string());
+  }
+
+  const auto read_content
+    ( [&] (std::string const& filename)
+      {
+        const boost::filesystem::path path (patch_filename.parent_path() / filename);
+        return std::string (mapped_file (path.string()).view());
+      }
+    );
+  const auto rest_of_line
+    ( [] (std::istringstream& fields)
+      {
+        std::string rest;
+        fields >> std::ws;
+        std::getline (fields, rest);
+        return rest;
+      }
+    );
+
+  std::string line;
+  for (int line_number (1); std::getline (patch, line); ++line_number)
+  {
+    std::istringstream fields (line);
+    std::string command;
+    if (!(fields >> command) || command[0] == '#')
+    {
+      continue;
+    }
+
+    int package;
+    int sequence;
+    int included_package;
+    std::string filename;
+    if (command == "add-package" && fields >> package)
+    {
+      database.add_package (package, rest_of_line (fields));
+    }
+    else if (command == "remove-package" && fields >> package)
+    {
+      database.remove_package (package);
+    }
+    else if (command == "remove-member" && fields >> package >> sequence)
+    {
+      database.remove_member (package, sequence);
+    }
+    else if (command == "script" && fields >> package >> sequence >> filename)
+    {
+      database.set_script (package, sequence, rest_of_line (fields), read_content (filename));
+    }
+    else if (command == "replace" && fields >> package >> sequence >> filename)
+    {
+      database.replace_member_content (package, sequence, read_content (filename));
+    }
+    else if (command == "include" && fields >> package >> sequence >> included_package)
+    {
+      database.relink_include (package, sequence, included_package);
+    }
+    else
+    {
+      throw std::invalid_argument
+        (patch_filename.string() + ":" + std::to_string (line_number) + ": bad command: " + line);
+    }
+  }
+}
+
+int main (int argc, char** argv)
+{
+  std::size_t jobs (1);
+  std::string output_dir;
+  std::vector<std::string> arguments;
+  for (int i (1); i < argc; ++i)
+  {
+    const std::string arg (argv[i]);
+    if ((arg == "--jobs" || arg == "-j") && i + 1 < argc)
+    {
+      jobs = std::stoul (argv[++i]);
+    }
+    else if (arg == "--output" && i + 1 < argc)
+    {
+      output_dir = argv[++i];
+    }
+    else
+    {
+      arguments.push_back (arg);
+    }
+  }
+  if (arguments.size() < 2)
+  {
+    std::cerr << "usage: " << argv[0] << " [--jobs N] [--output DIR] DBFILESCLIENT_DIR PATCH...\n";
+    return 1;
+  }
+
+  const boost::filesystem::path input_dir (arguments.front());
+  SceneScriptDatabase database (SceneScriptDatabase::load (input_dir, jobs));
+  for (std::size_t i (1); i < arguments.size(); ++i)
+  {
+    apply_patch (database, arguments[i]);
+  }
+
+  const boost::filesystem::path output (output_dir.empty() ? input_dir : boost::filesystem::path (output_dir));
+  boost::filesystem::create_directories (output);
+  database.save (output, std::cout);
+
+  return 0;
+}
@@ -1,177 +1,208 @@
 #include <boost/filesystem.hpp>
 
-#include <algorithm>
-#include <cstdio>
-#include <fstream>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#include "structures.hpp"
-
-std::vector<char> read_file (const std::string filename)
+#include "allocation_counter.hpp"
+#include "archive.hpp"
+#include "build_batch.hpp"
+#include "mapped_file.hpp"
+#include "output_backend.hpp"
+#include "package_view.hpp"
+#include "scene_script_tables.hpp"
+#include "stats.hpp"
+#include "tree_output.hpp"
+#include "trigram_index.hpp"
+
+// reader query [-i] [--regex] [--stats] INDEX PATTERN: searches an
+// index written with --index, see query_index()
+int query (int argc, char** argv)
 {
-  std::vector<char> buffer;
-  if (FILE* fp = fopen (filename.c_str(), "r"))
+  bool ignore_case (false);
+  bool regex (false);
+  bool print_stats (false);
+  std::vector<std::string> arguments;
+  for (int i (2); i < argc; ++i)
   {
-    char buf[1024];
-    while (size_t len = fread (buf, 1, sizeof(buf), fp))
+    const std::string arg (argv[i]);
+    if (arg == "-i")
+    {
+      ignore_case = true;
+    }
+    else if (arg == "--regex")
+    {
+      regex = true;
+    }
+    else if (arg == "--stats")
     {
-      buffer.insert (buffer.end(), buf, buf + len);
+      print_stats = true;
+    }
+    else
+    {
+      arguments.push_back (arg);
     }
-    fclose (fp);
   }
-  else
+  if (arguments.size() != 2)
   {
-    throw std::runtime_error ("file not opened: " + filename);
+    std::cerr << "usage: " << argv[0] << " query [-i] [--regex] [--stats] INDEX PATTERN\n";
+    return 1;
   }
-  return buffer;
-}
 
-template<typename Rec, typename RawRec>
-std::vector<Rec> get_records (std::vector<char> const& data)
-{
-  const DB2Header* header
-    (reinterpret_cast<const DB2Header*> (data.data()));
-  if (header->magic != '6BDW') throw std::invalid_argument ("bad header");
-  if (header->field_count != header->total_field_count) throw std::invalid_argument ("uses common data");
-  if (header->flags != 4) throw std::invalid_argument ("unknown flags");
-  if (header->record_size != sizeof (RawRec)) throw std::invalid_argument ("sizeof Raw mismatch");
-  if (header->layout_hash != RawRec::layout_hash) throw std::invalid_argument ("layout hash mismatch");
-
-  const RawRec* raw_records
-    (reinterpret_cast<const RawRec*> (data.data() + sizeof (DB2Header) + sizeof (uint32_t) * header->field_count));
-  const std::vector<RawRec> raw_records_vec (raw_records, raw_records + header->record_count);
-
-  const char* stringblock
-    (reinterpret_cast<char const*> (raw_records + header->record_count));
-
-  uint32_t const* ids
-    (reinterpret_cast<uint32_t const*> (stringblock + header->string_table_size));
-
-  std::vector<Rec> records;
-  std::size_t i (0);
-  for (RawRec const& rec : raw_records_vec)
+  if (print_stats)
   {
-    records.push_back (rec.unraw (*header, stringblock, header->flags & 4 ? ids[i] : -1));
-    ++i;
+    stats::enable();
   }
-
-  struct copy_table_entry
-  {
-    uint32_t id_of_new_row;
-    uint32_t id_of_copied_row;
-  };
-  copy_table_entry const* copies
-    (reinterpret_cast<copy_table_entry const*> (header->flags & 4 ? ids + header->record_count : ids));
-
-  for (std::size_t i (0); i < header->copy_table_size / sizeof (copy_table_entry); ++i)
+  const mapped_file file (arguments[0]);
+  const trigram_index index (file.data(), file.size());
+  const std::size_t found (query_index (index, arguments[1], regex, ignore_case, std::cout));
+  if (print_stats)
   {
-    auto it (std::find_if (records.begin(), records.end(), [&] (Rec const& rec)
-                 {
-                   return rec.id == copies[i].id_of_copied_row;
-                 }
-                          ));
-    records.push_back (it->clone (copies[i].id_of_new_row));
+    stats::report (std::cerr);
   }
-
-  return records;
-}
-
-std::string replace_not_permitted_characters (std::string str)
-{
-  std::replace (str.begin(), str.end(), '/', ',');
-  return str;
+  return found ? 0 : 1;
 }
 
 int main (int argc, char** argv)
 {
-  const std::string scene_script_filename
-    ("DBFilesClient/SceneScript.db2");
-  const std::string scene_script_package_filename
-    ("DBFilesClient/SceneScriptPackage.db2");
-  const std::string scene_script_package_member_filename
-    ("DBFilesClient/SceneScriptPackageMember.db2");
-
-  const boost::filesystem::path output_dir (boost::filesystem::current_path() / "scene_scripts");
-  const boost::filesystem::path by_name_dir (output_dir / "by name");
-  const boost::filesystem::path by_id_dir (output_dir / "by id");
-
-  boost::filesystem::create_directories (output_dir);
-  boost::filesystem::create_directories (by_name_dir);
-
-  const std::vector<char> scene_script
-    (read_file (scene_script_filename));
-  const std::vector<char> scene_script_package
-    (read_file (scene_script_package_filename));
-  const std::vector<char> scene_script_package_member
-    (read_file (scene_script_package_member_filename));
-
-  const std::vector<SceneScriptRec> scene_script_records
-    (get_records<SceneScriptRec, SceneScriptRecRaw> (scene_script));
-  const std::vector<SceneScriptPackageRec> scene_script_package_records
-    (get_records<SceneScriptPackageRec, SceneScriptPackageRecRaw> (scene_script_package));
-  const std::vector<SceneScriptPackageMemberRec> scene_script_package_member_records
-    (get_records<SceneScriptPackageMemberRec, SceneScriptPackageMemberRecRaw> (scene_script_package_member));
-
-  std::map<int, std::vector<SceneScriptRec>::const_iterator> scene_script_records_by_id;
-
-  for ( std::vector<SceneScriptRec>::const_iterator it (scene_script_records.cbegin())
-      ; it != scene_script_records.cend()
-      ; ++it
-      )
+  if (argc > 1 && std::string (argv[1]) == "query")
   {
-    scene_script_records_by_id.emplace (it->id, it);
+    return query (argc, argv);
   }
 
-  for (SceneScriptPackageRec const& rec : scene_script_package_records)
+  std::size_t jobs (1);
+  std::string from_archive;
+  std::string to_archive;
+  bool print_stats (false);
+  std::string trace_filename;
+  bool io_uring (false);
+  bool flatten (false);
+  std::string batch_output;
+  std::string index_filename;
+  std::vector<boost::filesystem::path> builds;
+  for (int i (1); i < argc; ++i)
   {
-    boost::filesystem::path dir (by_id_dir / std::to_string (rec.id));
-    boost::filesystem::create_directories (dir);
-    std::ofstream name_file ((dir / "name.txt").string());
-    name_file << rec.name;
-    std::ofstream id_file ((dir / "id.txt").string());
-    id_file << rec.id;
-    boost::filesystem::path link_dir (by_name_dir / replace_not_permitted_characters (rec.name));
-    boost::filesystem::create_symlink (dir, link_dir);
+    const std::string arg (argv[i]);
+    if ((arg == "--jobs" || arg == "-j") && i + 1 < argc)
+    {
+      jobs = std::stoul (argv[++i]);
+    }
+    else if (arg == "--from-archive" && i + 1 < argc)
+    {
+      from_archive = argv[++i];
+    }
+    else if (arg == "--to-archive" && i + 1 < argc)
+    {
+      to_archive = argv[++i];
+    }
+    else if (arg == "--stats")
+    {
+      print_stats = true;
+    }
+    else if (arg.compare (0, 8, "--trace=") == 0)
+    {
+      trace_filename = arg.substr (8);
+    }
+    else if (arg == "--io-uring")
+    {
+      io_uring = true;
+    }
+    else if (arg == "--flatten")
+    {
+      flatten = true;
+    }
+    else if (arg == "--index" && i + 1 < argc)
+    {
+      index_filename = argv[++i];
+    }
+    else if (arg == "--batch" && i + 1 < argc)
+    {
+      batch_output = argv[++i];
+    }
+    else if (!batch_output.empty() && arg.compare (0, 1, "-") != 0)
+    {
+      builds.push_back (arg);
+    }
+    else
+    {
+      std::cerr << "usage: " << argv[0] << " [--jobs N] [--from-archive FILE] [--to-archive FILE] [--stats] [--trace=FILE] [--io-uring] [--flatten] [--index FILE]\n"
+                << "       " << argv[0] << " [--jobs N] [--stats] [--trace=FILE] [--io-uring] --batch OUTPUT_DIR DBFILESCLIENT_DIR...\n"
+                << "       " << argv[0] << " query [-i] [--regex] [--stats] INDEX PATTERN\n";
+      return 1;
+    }
   }
 
-  for (SceneScriptPackageMemberRec const& rec : scene_script_package_member_records)
+  if (print_stats || !trace_filename.empty())
   {
-    boost::filesystem::path dir (by_id_dir / std::to_string (rec.package));
-    if (rec.script != 0)
-    {
-      std::string name;
-      for (int next_script = rec.script; next_script != 0;)
+    stats::enable();
+  }
+  const auto report_stats
+    ( [&]
       {
-        const std::vector<SceneScriptRec>::const_iterator script_rec
-          (scene_script_records_by_id.at (next_script));
-        if (name.empty())
+        if (print_stats)
+        {
+          stats::report (std::cout);
+        }
+        if (!trace_filename.empty())
         {
-          name = script_rec->name;
+          stats::write_chrome_trace (trace_filename);
         }
-        std::ofstream name_file ((dir / (std::to_string
-          (rec.sequence) + "." + name + ".lua")).string(), std::ios_base::app);
-        name_file << script_rec->content;
-        next_script = script_rec->next_script;
       }
-    }
-    else if (rec.d != 0)
-    {
-      boost::filesystem::path included (by_id_dir / std::to_string (rec.d));
-      std::ifstream inc_name_stream ((included / "name.txt").string());
-      std::string inc_name;
-      std::getline (inc_name_stream, inc_name);
-      boost::filesystem::path link_dir (dir / (std::to_string (rec.sequence) + "." + inc_name + ".inc"));
-      boost::filesystem::create_directory_symlink (included, link_dir);
-    }
-    else
+    );
+
+  if (!batch_output.empty())
+  {
+    const std::unique_ptr<output_backend> backend (make_output_backend (jobs, io_uring));
+    export_builds (batch_output, builds, jobs, *backend, std::cout);
+    report_stats();
+    return 0;
+  }
+
+  // the views point into the mapped files, so nothing is copied until
+  // it is written
+  std::unique_ptr<mapped_file> archive_file;
+  mapped_scene_script_tables tables;
+  std::vector<package_view> packages;
+
+  if (!from_archive.empty())
+  {
+    const stats::scope timer ("read archive");
+    archive_file.reset (new mapped_file (from_archive));
+    packages = read_archive (archive_file->data(), archive_file->size());
+  }
+  else
+  {
+    tables = read_scene_script_tables ("DBFilesClient", jobs);
+    const stats::scope timer ("packages_from_tables");
+    packages = tables.packages();
+  }
+
+  if (!to_archive.empty())
+  {
+    const stats::scope timer ("write archive");
+    const bool changed (write_archive (to_archive, packages));
+    std::cout << to_archive << ": " << (changed ? "written" : "unchanged") << "\n";
+  }
+  else
+  {
+    const std::unique_ptr<output_backend> backend (make_output_backend (jobs, io_uring));
+    export_tree (boost::filesystem::current_path() / "scene_scripts", packages, jobs, *backend, std::cout);
+    if (flatten)
     {
-      std::cerr << rec.id << ": neither script nor include\n";
+      export_flattened (boost::filesystem::current_path() / "scene_scripts" / "flattened", packages, *backend, std::cout);
     }
   }
 
+  if (!index_filename.empty())
+  {
+    const bool changed (write_trigram_index (index_filename, packages, jobs));
+    std::cout << index_filename << ": " << (changed ? "written" : "unchanged") << "\n";
+  }
+
+  report_stats();
+
   return 0;
 }
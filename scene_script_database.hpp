@@ -0,0 +1,643 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "arena.hpp"
+#include "chunking.hpp"
+#include "db2.hpp"
+#include "hash.hpp"
+#include "manifest.hpp"
+#include "mapped_file.hpp"
+#include "package_view.hpp"
+#include "parallel.hpp"
+#include "scene_script_tables.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+
+// names and contents are views into the arena of the database holding
+// the member. the hash is that of the file, even if the content is
+// already compacted, as when reused from a compacted save.
+struct package_member_t
+{
+  int package;
+  int sequence;
+  std::string_view name;
+  std::string_view content;
+  int include_id;
+  uintmax_t file_size;
+  int64_t file_mtime;
+  uint64_t content_hash;
+  bool compacted;
+};
+
+// the members of a package are the member_count members of the
+// database starting at first_member
+struct package_t
+{
+  int id;
+  std::string_view name;
+  std::size_t first_member;
+  std::size_t member_count;
+};
+
+// all scene script packages in memory, as the tree or an archive hold
+// them: per package its members by sequence, each either a script or an
+// include of another package. loaded from and saved to the three DB2s,
+// which are split into chunks and given ids on the way.
+//
+// the model is flat: packages() sorted by id and members() sorted by
+// package and sequence, each package holding the span of its members.
+// bulk additions are appended and sorted once, single edits insert in
+// place, so loading and saving are linear scans over contiguous memory.
+//
+// all names and contents live in strings(), a monotonic arena, so that
+// the model costs a few large allocations rather than two per member.
+// edits copy the new text into it, the old text stays until the
+// database is destroyed. the database is move-only.
+//
+// ids() holds the ids every member got when it was loaded or saved last,
+// sorted by package and sequence like the members. saving reuses them,
+// so rows keep their ids across edits and new rows get ids above any
+// ever used.
+//
+// scripts with the same name and content, e.g. a helper copied into many
+// packages, are saved once: their members all point at the same chain.
+class SceneScriptDatabase
+{
+public:
+  static constexpr const char* const scene_script_filename = mapped_scene_script_tables::scene_script_filename;
+  static constexpr const char* const scene_script_package_filename = mapped_scene_script_tables::scene_script_package_filename;
+  static constexpr const char* const scene_script_package_member_filename = mapped_scene_script_tables::scene_script_package_member_filename;
+
+  static SceneScriptDatabase load (const boost::filesystem::path dir, std::size_t jobs = 1)
+  {
+    const stats::scope timer ("load");
+    const mapped_scene_script_tables tables (read_scene_script_tables (dir, jobs));
+
+    const stats::scope add_timer ("add packages");
+    const std::vector<package_view> packages (tables.packages());
+    SceneScriptDatabase database;
+    database.add (packages);
+    for (package_view const& package : packages)
+    {
+      for (member_view const& member : package.members)
+      {
+        manifest_entry_t entry;
+        entry.package = package.id;
+        entry.sequence = member.sequence;
+        entry.member_id = member.id;
+        entry.size = 0;
+        entry.mtime = 0;
+        entry.hash = database.find_member (package.id, member.sequence).content_hash;
+        entry.saved_size = 0;
+        entry.saved_hash = entry.hash;
+        entry.script_ids = member.script_ids;
+        entry.name = std::string (member.name);
+        database._ids.push_back (std::move (entry));
+      }
+    }
+    sort_manifest (database._ids);
+    return database;
+  }
+
+  std::vector<package_t> const& packages() const
+  {
+    return _packages;
+  }
+  std::vector<package_member_t> const& members() const
+  {
+    return _members;
+  }
+
+  arena& strings()
+  {
+    return _strings;
+  }
+
+  manifest_t& ids()
+  {
+    return _ids;
+  }
+  manifest_t const& ids() const
+  {
+    return _ids;
+  }
+
+  // how scripts are split into rows when saving
+  chunk_options& chunking()
+  {
+    return _chunking;
+  }
+
+  // adds packages and members in any order, with one sort at the end.
+  // they replace existing ones with the same id, or package and
+  // sequence, as do later ones earlier ones. members of packages that do
+  // not exist are dropped. the spans of the given packages are ignored.
+  // names and contents have to live in strings().
+  void add (std::vector<package_t> const& packages, std::vector<package_member_t> const& members)
+  {
+    _packages.insert (_packages.end(), packages.begin(), packages.end());
+    _members.insert (_members.end(), members.begin(), members.end());
+    sort();
+  }
+
+  // adds copies of packages, see above
+  void add (std::vector<package_view> const& packages)
+  {
+    std::size_t member_count (0);
+    for (package_view const& package : packages)
+    {
+      _packages.push_back ({package.id, _strings.copy (package.name), 0, 0});
+      member_count += package.members.size();
+    }
+    _members.reserve (_members.size() + member_count);
+    for (package_view const& package : packages)
+    {
+      for (member_view const& member : package.members)
+      {
+        package_member_t added;
+        added.package = package.id;
+        added.sequence = member.sequence;
+        added.name = _strings.copy (member.name);
+        added.include_id = member.include_id;
+
+        std::size_t size (0);
+        for (std::string_view piece : member.content)
+        {
+          size += piece.size();
+        }
+        char* content (_strings.allocate (size));
+        added.content = {content, size};
+        for (std::string_view piece : member.content)
+        {
+          std::memcpy (content, piece.data(), piece.size());
+          content += piece.size();
+        }
+
+        added.file_size = added.content.size();
+        added.file_mtime = 0;
+        added.content_hash = fnv1a (added.content);
+        added.compacted = false;
+        _members.push_back (added);
+      }
+    }
+    sort();
+  }
+
+  void add_package (int id, std::string_view name)
+  {
+    const auto package (lower_bound_package (id));
+    if (package != _packages.end() && package->id == id)
+    {
+      throw std::invalid_argument ("package " + std::to_string (id) + " already exists");
+    }
+    const std::size_t first_member (package != _packages.end() ? package->first_member : _members.size());
+    _packages.insert (package, {id, _strings.copy (name), first_member, 0});
+  }
+
+  // members of other packages including it are removed as well
+  void remove_package (int id)
+  {
+    _packages.erase (_packages.begin() + (&find_package (id) - _packages.data()));
+    _members.erase ( std::remove_if ( _members.begin(), _members.end()
+                                    , [&] (package_member_t const& member)
+                                      {
+                                        return member.package == id || member.include_id == id;
+                                      }
+                                    )
+                   , _members.end()
+                   );
+    update_spans();
+  }
+
+  void remove_member (int package, int sequence)
+  {
+    _members.erase (_members.begin() + (&find_member (package, sequence) - _members.data()));
+    update_spans();
+  }
+
+  // adds the script if there is no member with that sequence yet
+  void set_script (int package, int sequence, std::string_view name, std::string_view content)
+  {
+    package_member_t& member (member_slot (package, sequence));
+    member.name = _strings.copy (name);
+    member.include_id = 0;
+    set_content (member, content);
+  }
+
+  void replace_member_content (int package, int sequence, std::string_view content)
+  {
+    package_member_t& member (find_member (package, sequence));
+    if (member.include_id)
+    {
+      throw std::invalid_argument ( "member " + std::to_string (sequence) + " of package "
+                                  + std::to_string (package) + " is an include"
+                                  );
+    }
+    set_content (member, content);
+  }
+
+  // makes the member an include of included_package, adding it if there
+  // is no member with that sequence yet
+  void relink_include (int package, int sequence, int included_package)
+  {
+    const std::string_view name (find_package (included_package).name);
+    package_member_t& member (member_slot (package, sequence));
+    member.name = name;
+    member.include_id = included_package;
+    set_content (member, {});
+  }
+
+  // splits scripts into chunks and assigns ids, updating ids()
+  scene_script_tables tables()
+  {
+    const stats::scope timer ("split into chunks");
+    check_chunk_options (_chunking);
+    scene_script_tables tables;
+
+    int package_member_id (1);
+    int script_id (1);
+    for (manifest_entry_t const& member : _ids)
+    {
+      package_member_id = std::max (package_member_id, member.member_id + 1);
+      for (int id : member.script_ids)
+      {
+        script_id = std::max (script_id, id + 1);
+      }
+    }
+
+    tables.packages.reserve (_packages.size());
+    tables.members.reserve (_members.size());
+    tables.scripts.reserve (_members.size());
+
+    // members and _ids are in the same order, so the previous entry of
+    // each member is found by advancing through _ids alongside
+    manifest_t ids;
+    ids.reserve (_members.size());
+
+    // the first member with a name and content owns the chain, the
+    // others take its ids. a previous id goes to one chain only, so a
+    // member that shared a chain and was edited since gets new ones.
+    arena nodes (1 << 16);
+    typedef std::pair<const chain_key, std::size_t> chain_entry;
+    std::unordered_map< chain_key, std::size_t, chain_key_hash, std::equal_to<chain_key>
+                      , arena_allocator<chain_entry>
+                      > chains ( _members.size(), chain_key_hash(), std::equal_to<chain_key>()
+                               , arena_allocator<chain_entry> (nodes)
+                               );
+    std::unordered_set<int, std::hash<int>, std::equal_to<int>, arena_allocator<int>>
+      claimed_script_ids (_ids.size(), std::hash<int>(), std::equal_to<int>(), arena_allocator<int> (nodes));
+    auto previous_entry (_ids.cbegin());
+    for (package_t const& package : _packages)
+    {
+      SceneScriptPackageRecView package_rec;
+      package_rec.id = package.id;
+      package_rec.name = package.name;
+
+      for (std::size_t m (package.first_member); m < package.first_member + package.member_count; ++m)
+      {
+        package_member_t const& member (_members[m]);
+        while ( previous_entry != _ids.cend()
+             && std::tie (previous_entry->package, previous_entry->sequence) < std::tie (member.package, member.sequence)
+              )
+        {
+          ++previous_entry;
+        }
+        manifest_entry_t const* const previous
+          ( previous_entry != _ids.cend()
+         && previous_entry->package == member.package && previous_entry->sequence == member.sequence
+          ? &*previous_entry
+          : nullptr
+          );
+
+        manifest_entry_t entry;
+        entry.package = member.package;
+        entry.sequence = member.sequence;
+        entry.member_id = previous ? previous->member_id : package_member_id++;
+        entry.size = member.file_size;
+        entry.mtime = member.file_mtime;
+        entry.hash = member.content_hash;
+        entry.saved_size = member.content.size();
+        entry.saved_hash = member.content_hash;
+        entry.name = std::string (member.name);
+
+        SceneScriptPackageMemberRec package_member_rec;
+        package_member_rec.id = entry.member_id;
+        package_member_rec.package = package_rec.id;
+        package_member_rec.script = 0;
+        package_member_rec.sequence = member.sequence;
+        package_member_rec.d = member.include_id;
+
+        if (!member.include_id)
+        {
+          const auto chain
+            (chains.emplace (chain_key {member.name, member.content, fnv1a (member.name, member.content_hash)}, ids.size()));
+          if (!chain.second)
+          {
+            entry.saved_size = ids[chain.first->second].saved_size;
+            entry.saved_hash = ids[chain.first->second].saved_hash;
+            entry.script_ids = ids[chain.first->second].script_ids;
+            package_member_rec.script = entry.script_ids.front();
+            stats::count ("shared scripts");
+            stats::count ("shared script bytes", member.content.size());
+          }
+          else
+          {
+            // compacted content is kept with the database, as the
+            // tables only view it
+            const std::string_view content
+              ( _chunking.compact && !member.compacted
+              ? _strings.copy (compact_lua (member.content))
+              : member.content
+              );
+            if (_chunking.compact && !member.compacted)
+            {
+              stats::count ("compacted script bytes saved", member.content.size() - content.size());
+            }
+            if (_chunking.compact)
+            {
+              entry.saved_size = content.size();
+              entry.saved_hash = fnv1a (content);
+            }
+            const std::vector<std::string_view> parts (split_into_chunks (content, _chunking.max_size));
+            const int content_parts (parts.size());
+
+            for (int content_part (0); content_part < content_parts; ++content_part)
+            {
+              entry.script_ids.push_back
+                ( previous && std::size_t (content_part) < previous->script_ids.size()
+               && claimed_script_ids.insert (previous->script_ids[content_part]).second
+                ? previous->script_ids[content_part]
+                : script_id++
+                );
+            }
+            package_member_rec.script = entry.script_ids.front();
+
+            for (int content_part (0); content_part < content_parts; ++content_part)
+            {
+              SceneScriptRecView script_rec;
+              script_rec.id = entry.script_ids[content_part];
+              script_rec.name = member.name;
+              script_rec.content = parts[content_part];
+              script_rec.previous_script = content_part != 0 ? entry.script_ids[content_part - 1] : 0;
+              script_rec.next_script = content_part != (content_parts - 1) ? entry.script_ids[content_part + 1] : 0;
+
+              tables.scripts.push_back (script_rec);
+            }
+          }
+        }
+
+        ids.push_back (std::move (entry));
+        tables.members.push_back (package_member_rec);
+      }
+      tables.packages.push_back (package_rec);
+    }
+
+    _ids = std::move (ids);
+    return tables;
+  }
+
+  // writes the three DB2s into dir, reporting the savings of each to log.
+  // with common_data, sparse trailing columns go to the common data table.
+  void save (const boost::filesystem::path dir, std::ostream& log, bool common_data = false)
+  {
+    const scene_script_tables recs (tables());
+    save_table<SceneScriptRecRaw> (dir / scene_script_filename, recs.scripts, log, common_data);
+    save_table<SceneScriptPackageRecRaw> (dir / scene_script_package_filename, recs.packages, log, common_data);
+    save_table<SceneScriptPackageMemberRecRaw> (dir / scene_script_package_member_filename, recs.members, log, common_data);
+  }
+
+  // views into this database, valid until it is modified
+  std::vector<package_view> views() const
+  {
+    std::vector<package_view> views;
+    views.reserve (_packages.size());
+    for (package_t const& package : _packages)
+    {
+      package_view view;
+      view.id = package.id;
+      view.name = package.name;
+      view.members.reserve (package.member_count);
+      for (std::size_t m (package.first_member); m < package.first_member + package.member_count; ++m)
+      {
+        view.members.push_back ( { _members[m].sequence
+                                 , _members[m].name
+                                 , _members[m].include_id
+                                 , content_pieces (1, _members[m].content)
+                                 , 0
+                                 , {}
+                                 }
+                               );
+      }
+      views.push_back (std::move (view));
+    }
+    return views;
+  }
+
+private:
+  // a script as saved, see tables(). hash covers name and content.
+  struct chain_key
+  {
+    std::string_view name;
+    std::string_view content;
+    uint64_t hash;
+
+    bool operator== (chain_key const& other) const
+    {
+      return hash == other.hash && name == other.name && content == other.content;
+    }
+  };
+  struct chain_key_hash
+  {
+    std::size_t operator() (chain_key const& key) const
+    {
+      return key.hash;
+    }
+  };
+
+  static bool member_order (package_member_t const& lhs, package_member_t const& rhs)
+  {
+    return std::tie (lhs.package, lhs.sequence) < std::tie (rhs.package, rhs.sequence);
+  }
+
+  // of each run of equal elements the last one, moved to the front
+  template<typename It, typename Equal>
+  static It keep_last (It first, It last, Equal const& equal)
+  {
+    It kept (first);
+    for (It it (first); it != last; ++it)
+    {
+      if (std::next (it) == last || !equal (*it, *std::next (it)))
+      {
+        *kept++ = *it;
+      }
+    }
+    return kept;
+  }
+
+  // restores the order after bulk additions, see add()
+  void sort()
+  {
+    const stats::scope timer ("sort packages");
+    std::stable_sort ( _packages.begin(), _packages.end()
+                     , [] (package_t const& lhs, package_t const& rhs) { return lhs.id < rhs.id; }
+                     );
+    _packages.erase ( keep_last ( _packages.begin(), _packages.end()
+                                , [] (package_t const& lhs, package_t const& rhs) { return lhs.id == rhs.id; }
+                                )
+                    , _packages.end()
+                    );
+    std::stable_sort (_members.begin(), _members.end(), member_order);
+    _members.erase ( keep_last ( _members.begin(), _members.end()
+                               , [] (package_member_t const& lhs, package_member_t const& rhs)
+                                 {
+                                   return !member_order (lhs, rhs) && !member_order (rhs, lhs);
+                                 }
+                               )
+                   , _members.end()
+                   );
+    update_spans();
+  }
+
+  // with both sorted, one pass drops members without a package and
+  // sets the spans
+  void update_spans()
+  {
+    std::size_t kept (0);
+    std::size_t m (0);
+    for (package_t& package : _packages)
+    {
+      while (m < _members.size() && _members[m].package < package.id)
+      {
+        ++m;
+      }
+      package.first_member = kept;
+      while (m < _members.size() && _members[m].package == package.id)
+      {
+        _members[kept++] = _members[m++];
+      }
+      package.member_count = kept - package.first_member;
+    }
+    _members.resize (kept);
+  }
+
+  std::vector<package_t>::iterator lower_bound_package (int id)
+  {
+    return std::lower_bound ( _packages.begin(), _packages.end(), id
+                            , [] (package_t const& package, int id) { return package.id < id; }
+                            );
+  }
+  // the members of package with a sequence not below the given one
+  std::vector<package_member_t>::iterator lower_bound_member (package_t const& package, int sequence)
+  {
+    const auto first (_members.begin() + package.first_member);
+    return std::lower_bound ( first, first + package.member_count, sequence
+                            , [] (package_member_t const& member, int sequence) { return member.sequence < sequence; }
+                            );
+  }
+
+  package_t& find_package (int id)
+  {
+    const auto package (lower_bound_package (id));
+    if (package == _packages.end() || package->id != id)
+    {
+      throw std::out_of_range ("unknown package " + std::to_string (id));
+    }
+    return *package;
+  }
+  package_member_t& find_member (int package, int sequence)
+  {
+    package_t const& found (find_package (package));
+    const auto member (lower_bound_member (found, sequence));
+    if (member == _members.begin() + found.first_member + found.member_count || member->sequence != sequence)
+    {
+      throw std::out_of_range ( "unknown member " + std::to_string (sequence)
+                              + " of package " + std::to_string (package)
+                              );
+    }
+    return *member;
+  }
+  // the member, inserted empty if there is none with that sequence yet.
+  // members are appended in order when building a database up, so the
+  // insertion is usually at the end.
+  package_member_t& member_slot (int package, int sequence)
+  {
+    package_t& found (find_package (package));
+    const auto member (lower_bound_member (found, sequence));
+    if (member != _members.begin() + found.first_member + found.member_count && member->sequence == sequence)
+    {
+      return *member;
+    }
+
+    package_member_t added;
+    added.package = package;
+    added.sequence = sequence;
+    added.include_id = 0;
+    added.file_size = 0;
+    added.file_mtime = 0;
+    added.content_hash = 0;
+    added.compacted = false;
+    const auto inserted (_members.insert (member, added));
+    ++found.member_count;
+    for (auto later (_packages.begin() + (&found - _packages.data()) + 1); later != _packages.end(); ++later)
+    {
+      ++later->first_member;
+    }
+    return *inserted;
+  }
+
+  void set_content (package_member_t& member, std::string_view content)
+  {
+    member.content = _strings.copy (content);
+    member.file_size = member.content.size();
+    member.file_mtime = 0;
+    member.content_hash = fnv1a (member.content);
+    member.compacted = false;
+  }
+
+  template<typename Raw, typename Rec>
+  static void save_table ( const boost::filesystem::path filename
+                         , std::vector<Rec> const& recs
+                         , std::ostream& log
+                         , bool common_data
+                         )
+  {
+    const stats::scope timer ("save " + filename.filename().string());
+    stats::count ("records " + filename.filename().string(), recs.size());
+    put_records_stats table_stats;
+    const std::vector<char> data (put_records<Raw> (recs, table_stats, common_data));
+    write_file (filename, {data.data(), data.size()});
+    log_stats (log, filename, table_stats);
+  }
+
+  static void log_stats (std::ostream& log, const boost::filesystem::path filename, put_records_stats const& stats)
+  {
+    log << filename.string() << ": copy table saved " << stats.copy_table_savings << " bytes, "
+        << "string table saved " << stats.string_table_savings << " bytes";
+    if (stats.common_data_savings)
+    {
+      log << ", common data saved " << stats.common_data_savings << " bytes";
+    }
+    log << "\n";
+  }
+
+  arena _strings;
+  std::vector<package_t> _packages;
+  std::vector<package_member_t> _members;
+  manifest_t _ids;
+  chunk_options _chunking;
+};
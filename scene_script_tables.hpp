@@ -0,0 +1,85 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db2.hpp"
+#include "mapped_file.hpp"
+#include "package_view.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "structures.hpp"
+
+// the records of the three tables, as views into the files they were
+// decoded from or the database they were made from
+struct scene_script_tables
+{
+  std::vector<SceneScriptRecView> scripts;
+  std::vector<SceneScriptPackageRecView> packages;
+  std::vector<SceneScriptPackageMemberRec> members;
+};
+
+// the three tables of a DBFilesClient directory, decoded in place: the
+// records view the mapped files, which are kept as long as this is.
+struct mapped_scene_script_tables
+{
+  static constexpr const char* const scene_script_filename = "SceneScript.db2";
+  static constexpr const char* const scene_script_package_filename = "SceneScriptPackage.db2";
+  static constexpr const char* const scene_script_package_member_filename = "SceneScriptPackageMember.db2";
+
+  std::vector<std::unique_ptr<mapped_file>> files;
+  scene_script_tables records;
+
+  std::vector<package_view> packages() const
+  {
+    return packages_from_tables (records.scripts, records.packages, records.members);
+  }
+};
+
+// maps and decodes the tables in dir, one per job
+inline mapped_scene_script_tables read_scene_script_tables (const boost::filesystem::path dir, std::size_t jobs)
+{
+  const char* const filenames[] = { mapped_scene_script_tables::scene_script_filename
+                                  , mapped_scene_script_tables::scene_script_package_filename
+                                  , mapped_scene_script_tables::scene_script_package_member_filename
+                                  };
+
+  mapped_scene_script_tables tables;
+  for (const char* filename : filenames)
+  {
+    tables.files.emplace_back (new mapped_file ((dir / filename).string()));
+  }
+  mapped_file const& scene_script_file (*tables.files[0]);
+  mapped_file const& scene_script_package_file (*tables.files[1]);
+  mapped_file const& scene_script_package_member_file (*tables.files[2]);
+
+  parallel_for (jobs, 3, [&] (std::size_t table)
+    {
+      const stats::scope timer (std::string ("decode ") + filenames[table]);
+      switch (table)
+      {
+      case 0:
+        tables.records.scripts = get_views
+          (DB2View<SceneScriptRecRaw> (scene_script_file.data(), scene_script_file.size()));
+        break;
+      case 1:
+        tables.records.packages = get_views
+          (DB2View<SceneScriptPackageRecRaw> (scene_script_package_file.data(), scene_script_package_file.size()));
+        break;
+      case 2:
+        tables.records.members = get_views
+          (DB2View<SceneScriptPackageMemberRecRaw> (scene_script_package_member_file.data(), scene_script_package_member_file.size()));
+        break;
+      }
+    }
+  );
+
+  stats::count (std::string ("records ") + filenames[0], tables.records.scripts.size());
+  stats::count (std::string ("records ") + filenames[1], tables.records.packages.size());
+  stats::count (std::string ("records ") + filenames[2], tables.records.members.size());
+
+  return tables;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// instrumentation of the tools: scoped phase timers and named counters,
+// reported as a summary or written as a Chrome trace (chrome://tracing,
+// ui.perfetto.dev). nothing is recorded unless enabled, so that a
+// disabled timer or counter costs a relaxed load.
+class stats
+{
+public:
+  typedef std::chrono::steady_clock clock;
+  typedef clock::time_point clock_time;
+
+  // allocations, counted by the operator new of allocation_counter.hpp
+  // in the binaries that include it. only while counting_allocations(),
+  // which enable() turns on as well, so that the counters are not
+  // contended otherwise.
+  static inline std::atomic<std::size_t> allocations {0};
+  static inline std::atomic<std::size_t> allocated_bytes {0};
+
+  static bool counting_allocations()
+  {
+    return _counting_allocations.load (std::memory_order_relaxed);
+  }
+  static void count_allocations()
+  {
+    _counting_allocations = true;
+  }
+
+  static bool enabled()
+  {
+    return _enabled.load (std::memory_order_relaxed);
+  }
+  static void enable()
+  {
+    count_allocations();
+    instance()._start = clock::now();
+    instance()._start_allocations = allocations;
+    instance()._start_allocated_bytes = allocated_bytes;
+    _enabled = true;
+  }
+
+  static void count (std::string_view name, uint64_t n = 1)
+  {
+    if (enabled())
+    {
+      stats& s (instance());
+      const std::lock_guard<std::mutex> lock (s._mutex);
+      s._counters[std::string (name)] += n;
+    }
+  }
+
+  // times its own lifetime as a phase with the given name. nested and
+  // concurrent phases are fine, their times add up in the summary.
+  class scope
+  {
+  public:
+    explicit scope (std::string_view name)
+      : _enabled (stats::enabled())
+    {
+      if (_enabled)
+      {
+        _name = name;
+        _start = clock::now();
+      }
+    }
+    ~scope()
+    {
+      if (_enabled)
+      {
+        instance().add_event (std::move (_name), _start, clock::now());
+      }
+    }
+    scope (scope const&) = delete;
+    scope& operator= (scope const&) = delete;
+
+  private:
+    bool _enabled;
+    std::string _name;
+    clock_time _start;
+  };
+
+  // per phase the number of times it ran and the time spent in it,
+  // summed over threads, then the counters
+  static void report (std::ostream& out)
+  {
+    stats& s (instance());
+    const std::lock_guard<std::mutex> lock (s._mutex);
+
+    struct phase_total
+    {
+      std::size_t calls;
+      double seconds;
+    };
+    std::map<std::string, phase_total> phases;
+    std::vector<std::string> order;
+    for (event const& e : s._events)
+    {
+      auto phase (phases.emplace (e.name, phase_total {0, 0.0}));
+      if (phase.second)
+      {
+        order.push_back (e.name);
+      }
+      ++phase.first->second.calls;
+      phase.first->second.seconds += std::chrono::duration<double> (e.end - e.start).count();
+    }
+
+    out << pad ("phase", 48) << " " << pad_left ("calls", 7) << " " << pad_left ("ms", 9) << "\n";
+    for (std::string const& name : order)
+    {
+      phase_total const& total (phases[name]);
+      out << pad (name, 48) << " " << pad_left (std::to_string (total.calls), 7)
+          << " " << pad_left (milliseconds (total.seconds), 9) << "\n";
+    }
+    out << pad ("total", 56) << " "
+        << pad_left (milliseconds (std::chrono::duration<double> (clock::now() - s._start).count()), 9) << "\n";
+
+    for (auto const& counter : s.counters())
+    {
+      out << pad (counter.first, 48) << " " << pad_left (std::to_string (counter.second), 17) << "\n";
+    }
+  }
+
+  // a complete event per phase with the thread it ran on, the counters
+  // as one counter event at the end
+  static void write_chrome_trace (std::string const& filename)
+  {
+    stats& s (instance());
+    const std::lock_guard<std::mutex> lock (s._mutex);
+
+    std::ofstream out (filename);
+    if (!out)
+    {
+      throw std::runtime_error ("file not opened: " + filename);
+    }
+    out << "{\"traceEvents\":[\n";
+    for (event const& e : s._events)
+    {
+      out << "{\"name\":\"" << json_escape (e.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+          << ",\"ts\":" << microseconds (e.start - s._start)
+          << ",\"dur\":" << microseconds (e.end - e.start) << "},\n";
+    }
+    out << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":"
+        << microseconds (clock::now() - s._start) << ",\"args\":{";
+    bool first (true);
+    for (auto const& counter : s.counters())
+    {
+      out << (first ? "" : ",") << "\"" << json_escape (counter.first) << "\":" << counter.second;
+      first = false;
+    }
+    out << "}}\n]}\n";
+    if (!out)
+    {
+      throw std::runtime_error ("file not written: " + filename);
+    }
+  }
+
+private:
+  struct event
+  {
+    std::string name;
+    clock_time start;
+    clock_time end;
+    std::size_t thread;
+  };
+
+  static stats& instance()
+  {
+    static stats s;
+    return s;
+  }
+
+  // small, stable numbers for threads, in order of their first event
+  static std::size_t thread_number()
+  {
+    static std::atomic<std::size_t> threads {0};
+    thread_local const std::size_t number (threads++);
+    return number;
+  }
+
+  void add_event (std::string name, clock_time start, clock_time end)
+  {
+    const std::size_t thread (thread_number());
+    const std::lock_guard<std::mutex> lock (_mutex);
+    _events.push_back ({std::move (name), start, end, thread});
+  }
+
+  std::map<std::string, uint64_t> counters() const
+  {
+    std::map<std::string, uint64_t> all (_counters);
+    if (allocations != 0)
+    {
+      all["allocations"] = allocations - _start_allocations;
+      all["allocated bytes"] = allocated_bytes - _start_allocated_bytes;
+    }
+    return all;
+  }
+
+  static std::string pad (std::string str, std::size_t width)
+  {
+    str.resize (std::max (width, str.size()), ' ');
+    return str;
+  }
+  static std::string pad_left (std::string const& str, std::size_t width)
+  {
+    return std::string (width - std::min (width, str.size()), ' ') + str;
+  }
+  static std::string milliseconds (double seconds)
+  {
+    char buffer[32];
+    std::snprintf (buffer, sizeof (buffer), "%.2f", seconds * 1000);
+    return buffer;
+  }
+  static long long microseconds (clock::duration duration)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds> (duration).count();
+  }
+  static std::string json_escape (std::string const& str)
+  {
+    std::string escaped;
+    for (char c : str)
+    {
+      if (c == '"' || c == '\\')
+      {
+        escaped += '\\';
+      }
+      if (static_cast<unsigned char> (c) >= 0x20)
+      {
+        escaped += c;
+      }
+    }
+    return escaped;
+  }
+
+  static inline std::atomic<bool> _enabled {false};
+  static inline std::atomic<bool> _counting_allocations {false};
+
+  std::mutex _mutex;
+  clock_time _start;
+  std::size_t _start_allocations = 0;
+  std::size_t _start_allocated_bytes = 0;
+  std::vector<event> _events;
+  std::map<std::string, uint64_t> _counters;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+
+// builds a DB2 string block. all strings are added first and laid out
+// in one go, so that equal strings are stored once and a string that is
+// the tail of another one points into that one instead of being stored.
+// added strings are not copied and have to outlive the pool.
+class string_pool
+{
+public:
+  string_pool() = default;
+  // _offsets allocates from _nodes, it cannot move along with it
+  string_pool (string_pool const&) = delete;
+  string_pool& operator= (string_pool const&) = delete;
+
+  void add (std::string_view str)
+  {
+    _added_bytes += str.size() + 1;
+    if (_offsets.emplace (str, 0).second)
+    {
+      _strings.push_back (str);
+    }
+  }
+
+  void build()
+  {
+    std::vector<std::size_t> by_reverse (_strings.size());
+    for (std::size_t i (0); i < by_reverse.size(); ++i)
+    {
+      by_reverse[i] = i;
+    }
+    std::sort ( by_reverse.begin(), by_reverse.end()
+              , [&] (std::size_t lhs, std::size_t rhs)
+                {
+                  return std::lexicographical_compare
+                    ( _strings[lhs].rbegin(), _strings[lhs].rend()
+                    , _strings[rhs].rbegin(), _strings[rhs].rend()
+                    );
+                }
+              );
+
+    // sorted by their reversed contents, a string that is the tail of
+    // any other string is the tail of the one right after it.
+    std::vector<std::size_t> tail_of (_strings.size(), npos);
+    std::size_t size (2);
+    for (std::size_t i (0); i + 1 < by_reverse.size(); ++i)
+    {
+      std::string_view const& str (_strings[by_reverse[i]]);
+      std::string_view const& next (_strings[by_reverse[i + 1]]);
+      if ( next.size() >= str.size()
+        && next.compare (next.size() - str.size(), str.size(), str) == 0
+         )
+      {
+        tail_of[by_reverse[i]] = by_reverse[i + 1];
+      }
+    }
+    for (std::size_t i (0); i < _strings.size(); ++i)
+    {
+      if (tail_of[i] == npos)
+      {
+        size += _strings[i].size() + 1;
+      }
+    }
+    if (size > std::numeric_limits<uint32_t>::max())
+    {
+      throw std::length_error ("string block exceeds 4 GiB");
+    }
+
+    _block.clear();
+    _block.reserve (size);
+    _block.push_back ('\0'); _block.push_back ('\0');
+    for (std::size_t i (0); i < _strings.size(); ++i)
+    {
+      if (tail_of[i] == npos)
+      {
+        _offsets[_strings[i]] = _block.size();
+        _block.insert (_block.end(), _strings[i].begin(), _strings[i].end());
+        _block.push_back ('\0');
+      }
+    }
+    for (std::size_t i (by_reverse.size()); i-- > 0;)
+    {
+      const std::size_t tail (by_reverse[i]);
+      if (tail_of[tail] != npos)
+      {
+        std::string_view const& str (_strings[tail]);
+        std::string_view const& whole (_strings[tail_of[tail]]);
+        _offsets[str] = _offsets[whole] + whole.size() - str.size();
+      }
+    }
+  }
+
+  // only valid after build()
+  uint32_t offset (std::string_view str) const
+  {
+    const auto it (_offsets.find (str));
+    if (it == _offsets.end())
+    {
+      throw std::out_of_range ("string not added to pool");
+    }
+    return it->second;
+  }
+
+  std::vector<char> const& block() const
+  {
+    return _block;
+  }
+  // bytes the strings would take if every one was stored on its own
+  std::size_t added_bytes() const
+  {
+    return _added_bytes;
+  }
+
+private:
+  static constexpr std::size_t npos = std::size_t (-1);
+
+  typedef std::pair<const std::string_view, uint32_t> offset_entry;
+
+  // the nodes of _offsets, one allocation per block instead of per string
+  arena _nodes {1 << 16};
+  std::vector<std::string_view> _strings;
+  std::unordered_map< std::string_view, uint32_t
+                    , std::hash<std::string_view>, std::equal_to<std::string_view>
+                    , arena_allocator<offset_entry>
+                    > _offsets { 0, std::hash<std::string_view>(), std::equal_to<std::string_view>()
+             , arena_allocator<offset_entry> (_nodes)
+             };
+  std::vector<char> _block;
+  std::size_t _added_bytes = 0;
+};
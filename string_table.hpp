@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#endif
+
+// reads a DB2 string block, the counterpart of string_pool. the block is
+// scanned once for NULs, in bulk, into a bitmap. an offset is valid if a
+// NUL follows it inside the block: as string_pool shares tails, strings
+// may start anywhere, not just after a NUL. lengths are then taken from
+// the bitmap and never run past the block.
+class string_table
+{
+public:
+  string_table()
+    : _data (nullptr)
+    , _size (0)
+    , _last_nul (npos)
+  {}
+
+  string_table (const char* data, std::size_t size)
+    : _data (data)
+    , _size (size)
+    , _nuls ((size + 63) / 64, 0)
+    , _last_nul (npos)
+  {
+    find_nuls (data, size, _nuls.data());
+    for (std::size_t word (_nuls.size()); word != 0; --word)
+    {
+      if (_nuls[word - 1])
+      {
+        _last_nul = (word - 1) * 64 + 63 - __builtin_clzll (_nuls[word - 1]);
+        break;
+      }
+    }
+  }
+
+  const char* data() const
+  {
+    return _data;
+  }
+  std::size_t size() const
+  {
+    return _size;
+  }
+
+  bool valid (uint32_t offset) const
+  {
+    return _last_nul != npos && offset <= _last_nul;
+  }
+
+  // the string at a valid offset
+  std::string_view at (uint32_t offset) const
+  {
+    std::size_t word (offset / 64);
+    uint64_t bits (_nuls[word] >> (offset % 64));
+    if (bits)
+    {
+      return {_data + offset, std::size_t (__builtin_ctzll (bits))};
+    }
+    while (!_nuls[++word]);
+    return {_data + offset, word * 64 + __builtin_ctzll (_nuls[word]) - offset};
+  }
+
+private:
+  static constexpr std::size_t npos = std::size_t (-1);
+
+  static void find_nuls_scalar (const char* data, std::size_t begin, std::size_t end, uint64_t* bits)
+  {
+    for (std::size_t i (begin); i < end; ++i)
+    {
+      bits[i / 64] |= uint64_t (data[i] == '\0') << (i % 64);
+    }
+  }
+
+#if defined (__SSE2__)
+  static std::size_t find_nuls_sse2 (const char* data, std::size_t size, uint64_t* bits)
+  {
+    const __m128i zero (_mm_setzero_si128());
+    std::size_t i (0);
+    for (; i + 64 <= size; i += 64)
+    {
+      uint64_t word (0);
+      for (std::size_t part (0); part < 4; ++part)
+      {
+        const __m128i chunk (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (data + i + 16 * part)));
+        word |= uint64_t (uint16_t (_mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, zero)))) << (16 * part);
+      }
+      bits[i / 64] = word;
+    }
+    return i;
+  }
+#endif
+
+#if defined (__x86_64__) && (defined (__GNUC__) || defined (__clang__))
+  __attribute__ ((target ("avx2")))
+  static std::size_t find_nuls_avx2 (const char* data, std::size_t size, uint64_t* bits)
+  {
+    const __m256i zero (_mm256_setzero_si256());
+    std::size_t i (0);
+    for (; i + 64 <= size; i += 64)
+    {
+      const __m256i low (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (data + i)));
+      const __m256i high (_mm256_loadu_si256 (reinterpret_cast<const __m256i*> (data + i + 32)));
+      bits[i / 64]
+        = uint64_t (uint32_t (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (low, zero))))
+        | uint64_t (uint32_t (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (high, zero)))) << 32;
+    }
+    return i;
+  }
+#endif
+
+  // whole 64 byte blocks with the widest vectors the cpu has, the rest
+  // byte by byte
+  static void find_nuls (const char* data, std::size_t size, uint64_t* bits)
+  {
+    std::size_t done (0);
+#if defined (__x86_64__) && (defined (__GNUC__) || defined (__clang__))
+    if (__builtin_cpu_supports ("avx2"))
+    {
+      done = find_nuls_avx2 (data, size, bits);
+    }
+    else
+#endif
+    {
+#if defined (__SSE2__)
+      done = find_nuls_sse2 (data, size, bits);
+#endif
+    }
+    find_nuls_scalar (data, done, size, bits);
+  }
+
+  const char* _data;
+  std::size_t _size;
+  std::vector<uint64_t> _nuls;
+  std::size_t _last_nul;
+};
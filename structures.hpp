@@ -1,4 +1,13 @@
+#pragma once
+
 #include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db2_schema.hpp"
+#include "string_pool.hpp"
 
 struct DB2Header
 {
@@ -21,60 +30,34 @@ struct DB2Header
 
 static_assert (sizeof (DB2Header) == 0x38, "size of DB2Header");
 
-namespace
-{
-  uint32_t emplace_string (std::vector<char>& stringblock, std::string str)
-  {
-    uint32_t pos (stringblock.size());
-    for (char const& c : str)
-    {
-      stringblock.emplace_back (c);
-    }
-    stringblock.emplace_back ('\0');
-    return pos;
-  }
-}
+// each table is described once: the record lists its columns in file
+// order with their field_layout size, db2_raw generates the rest. the
+// string-carrying records are templates so that the owning record and
+// the view into a mapped file share that description.
 
-struct SceneScriptPackageRecRaw;
-struct SceneScriptPackageRec
+template<typename String>
+struct SceneScriptPackageRecT
 {
   int id;
-  std::string name;
-  SceneScriptPackageRec clone (int newid) const
+  String name;
+  typedef db2_fields< db2_field<&SceneScriptPackageRecT::name, 0>
+                    > fields;
+  SceneScriptPackageRecT clone (int newid) const
   {
     auto x (*this);
     x.id = newid;
     return x;
   }
-  SceneScriptPackageRecRaw raw (std::vector<char>& stringblock) const;
 };
+typedef SceneScriptPackageRecT<std::string> SceneScriptPackageRec;
+typedef SceneScriptPackageRecT<std::string_view> SceneScriptPackageRecView;
 
-struct SceneScriptPackageRecRaw
-{
-  unsigned int name;
-  static const unsigned int table_hash = 0xE8CB5E09;
-  static constexpr uint32_t const layout_hash = 956619678;
-  static constexpr uint32_t const field_count = 2;
-  static constexpr std::array<uint16_t, 2> field_layout = {0, 0};
-  SceneScriptPackageRec unraw (DB2Header const& header, const char* stringblock, int id) const
-  {
-    SceneScriptPackageRec rec;
-    rec.id = id;
-    rec.name = name + stringblock;
-    return rec;
-  }
-};
+typedef db2_raw< SceneScriptPackageRec, SceneScriptPackageRecView
+               , 0xE8CB5E09, 956619678
+               > SceneScriptPackageRecRaw;
 static_assert (sizeof (SceneScriptPackageRecRaw) == 0x4, "size of SceneScriptPackageRecRaw");
 
-SceneScriptPackageRecRaw SceneScriptPackageRec::raw (std::vector<char>& stringblock) const
-{
-  SceneScriptPackageRecRaw rec;
-  rec.name = emplace_string (stringblock, name);
-  return rec;
-}
-
 
-struct SceneScriptPackageMemberRecRaw;
 struct SceneScriptPackageMemberRec
 {
   int id;
@@ -82,99 +65,60 @@ struct SceneScriptPackageMemberRec
   int script;
   int d;
   int sequence;
+  typedef db2_fields< db2_field<&SceneScriptPackageMemberRec::package, 0x10>
+                    , db2_field<&SceneScriptPackageMemberRec::script, 0x10>
+                    , db2_field<&SceneScriptPackageMemberRec::d, 0x10>
+                    , db2_field<&SceneScriptPackageMemberRec::sequence, 0x18>
+                    > fields;
   SceneScriptPackageMemberRec clone (int newid) const
   {
     auto x (*this);
     x.id = newid;
     return x;
   }
-  SceneScriptPackageMemberRecRaw raw (std::vector<char>& stringblock) const;
-};
-
-struct SceneScriptPackageMemberRecRaw
-{
-  uint16_t package;
-  uint16_t script;
-  uint16_t d;
-  uint16_t sequence;
-  static const unsigned int table_hash = 0xE44DB71C;
-  static constexpr uint32_t const layout_hash = 275693289;
-  static constexpr uint32_t const field_count = 5;
-  static constexpr std::array<uint16_t, 8> field_layout = {0x10, 0, 0x10, 2, 0x10, 4, 0x18, 6};
-  SceneScriptPackageMemberRec unraw (DB2Header const& header, const char* stringblock, int id) const
-  {
-    SceneScriptPackageMemberRec rec;
-    rec.id = id;
-    rec.package = package;
-    rec.script = script;
-    rec.sequence = sequence;
-    rec.d = d;
-    return rec;
-  }
 };
-static_assert (sizeof (SceneScriptPackageMemberRecRaw) == 0x8, "size of SceneScriptPackageMemberRec");
 
-SceneScriptPackageMemberRecRaw SceneScriptPackageMemberRec::raw (std::vector<char>& stringblock) const
-{
-  SceneScriptPackageMemberRecRaw rec;
-  rec.package = package;
-  rec.script = script;
-  rec.d = d;
-  rec.sequence = sequence;
-  return rec;
-}
+// no strings, so the decoded record is as cheap as a view
+typedef db2_raw< SceneScriptPackageMemberRec, SceneScriptPackageMemberRec
+               , 0xE44DB71C, 275693289
+               > SceneScriptPackageMemberRecRaw;
+static_assert (sizeof (SceneScriptPackageMemberRecRaw) == 0x8, "size of SceneScriptPackageMemberRecRaw");
 
 
-struct SceneScriptRecRaw;
-struct SceneScriptRec
+template<typename String>
+struct SceneScriptRecT
 {
   int id;
-  std::string name;
-  std::string content;
+  String name;
+  String content;
   int previous_script;
   int next_script;
-  SceneScriptRec clone (int newid) const
+  typedef db2_fields< db2_field<&SceneScriptRecT::name, 0>
+                    , db2_field<&SceneScriptRecT::content, 0>
+                    , db2_field<&SceneScriptRecT::previous_script, 0x10>
+                    , db2_field<&SceneScriptRecT::next_script, 0x10>
+                    > fields;
+  SceneScriptRecT clone (int newid) const
   {
     auto x (*this);
     x.id = newid;
     return x;
   }
-  SceneScriptRecRaw raw (std::vector<char>& stringblock) const;
 };
+typedef SceneScriptRecT<std::string> SceneScriptRec;
+typedef SceneScriptRecT<std::string_view> SceneScriptRecView;
 
-struct SceneScriptRecRaw
-{
-  uint32_t name;
-  uint32_t content;
-  uint16_t previous_script;
-  uint16_t next_script;
-  static const unsigned int table_hash = 0xD4B163CC;
-  static constexpr uint32_t const layout_hash = 1240380216;
-  static constexpr uint32_t const field_count = 5;
-  static constexpr std::array<uint16_t, 8> const field_layout = {0, 0, 0, 4, 0x10, 8, 0x10, 0xa};
-  SceneScriptRec unraw (DB2Header const& header, const char* stringblock, int id) const
-  {
-    SceneScriptRec rec;
-    rec.id = id;
-    rec.name = name + stringblock;
-    rec.content = content + stringblock;
-    rec.next_script = next_script;
-    rec.previous_script = previous_script;
-    return rec;
-  }
-};
+typedef db2_raw< SceneScriptRec, SceneScriptRecView
+               , 0xD4B163CC, 1240380216
+               > SceneScriptRecRaw;
 static_assert (sizeof (SceneScriptRecRaw) == 0xc, "size of SceneScriptRecRaw");
-
-SceneScriptRecRaw SceneScriptRec::raw (std::vector<char>& stringblock) const
-{
-  SceneScriptRecRaw rec;
-  rec.name = emplace_string (stringblock, name);
-  rec.content = emplace_string (stringblock, content);
-  rec.previous_script = previous_script;
-  rec.next_script = next_script;
-  return rec;
-}
-
-constexpr std::array<uint16_t, 8> const SceneScriptRecRaw::field_layout;
-constexpr std::array<uint16_t, 2> const SceneScriptPackageRecRaw::field_layout;
-constexpr std::array<uint16_t, 8> const SceneScriptPackageMemberRecRaw::field_layout;
+static_assert ( same_layout ( SceneScriptRecRaw::field_layout
+                            , std::array<uint16_t, 8> {0, 0, 0, 4, 0x10, 8, 0x10, 0xa}
+                            )
+              , "field_layout of SceneScriptRecRaw"
+              );
+static_assert ( same_layout ( SceneScriptPackageMemberRecRaw::field_layout
+                            , std::array<uint16_t, 8> {0x10, 0, 0x10, 2, 0x10, 4, 0x18, 6}
+                            )
+              , "field_layout of SceneScriptPackageMemberRecRaw"
+              );
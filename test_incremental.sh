@@ -0,0 +1,54 @@
+#!/bin/bash
+# runs the writer with --incremental --compact twice on a small tree and
+# checks that the second run reuses every script and writes the same
+# DB2s, then that --no-compact does not take the compacted rows, which
+# lack the comments, for the files. usage: test_incremental.sh [writer]
+set -e
+writer="$(realpath "${1:-./writer}")"
+dir="$(mktemp -d)"
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+packages="scene_scripts/by id"
+for p in 1 2 3; do
+  mkdir -p "$packages/$p"
+  printf "package $p" > "$packages/$p/name.txt"
+  printf -- "-- helper\nlocal x  =  $p\n\n" > "$packages/$p/1.Helper.lua"
+  for i in $(seq 1 $((p * 100))); do
+    printf "print (\"line $i\")  -- comment\n"
+  done > "$packages/$p/2.Main.lua"
+done
+ln -s "$dir/$packages/1" "$packages/2/3.package 1.inc"
+
+expect_unchanged()
+{
+  if ! grep -q "^DBFilesClient_out/scene_scripts.manifest: $1 of 6 scripts unchanged$" output.txt; then
+    cat output.txt
+    echo "expected $1 of 6 scripts unchanged" >&2
+    exit 1
+  fi
+}
+
+mkdir DBFilesClient_out
+"$writer" --incremental --compact > output.txt
+expect_unchanged 0
+cp -r DBFilesClient_out first
+
+"$writer" --incremental --compact > output.txt
+expect_unchanged 6
+for table in SceneScript SceneScriptPackage SceneScriptPackageMember; do
+  cmp first/$table.db2 DBFilesClient_out/$table.db2
+done
+
+touch "$packages/2/2.Main.lua"
+"$writer" --incremental --compact > output.txt
+expect_unchanged 5
+
+grep -q -- "-- comment" DBFilesClient_out/SceneScript.db2 && exit 1
+"$writer" --incremental --no-compact > output.txt
+expect_unchanged 0
+grep -q -- "-- comment" DBFilesClient_out/SceneScript.db2
+"$writer" --incremental --no-compact > output.txt
+expect_unchanged 6
+
+echo "incremental writes with compaction reuse scripts"
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/range/iterator_range.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "arena.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "scene_script_database.hpp"
+#include "stats.hpp"
+
+// reading a tree as the reader exports it, the by id directory of
+// scene_scripts, back into a database. the writer's way from the tree
+// to the DB2s, minus saving.
+
+// buffer is where the content goes, file_size chars in the database's
+// arena, allocated before the members are read in parallel
+struct lua_member_t
+{
+  package_member_t* member;
+  boost::filesystem::path path;
+  char* buffer;
+};
+
+// a package directory as found by scan_package. .lua members are only
+// listed, their content is read later so that it can be spread over
+// threads independently of package sizes. names are kept in strings,
+// which the database adopts along with the package.
+struct scanned_package_t
+{
+  bool valid;
+  package_t package;
+  std::vector<package_member_t> members;
+  std::vector<lua_member_t> lua_members;
+  arena strings {1 << 12};
+};
+
+inline void scan_package (const boost::filesystem::path package_dir, scanned_package_t& scanned)
+{
+  scanned.valid = false;
+
+  if (package_dir.stem().string().empty())
+  {
+    return;
+  }
+
+  const stats::scope timer ("scan package");
+  stats::count ("package directories");
+
+  std::ifstream package_name_stream ((package_dir / "name.txt").string());
+  std::string package_name;
+  std::getline (package_name_stream, package_name);
+
+  scanned.package.id = std::stoi (package_dir.stem().string());
+  scanned.package.name = scanned.strings.copy (package_name);
+
+  for ( boost::filesystem::directory_entry member_dentry
+      : boost::make_iterator_range (boost::filesystem::directory_iterator (package_dir), boost::filesystem::directory_iterator())
+      )
+  {
+    const boost::filesystem::path member_path (member_dentry.path());
+
+    if (member_path.stem().string().empty())
+    {
+      continue;
+    }
+
+    package_member_t package_member;
+    package_member.package = scanned.package.id;
+    const std::string member_path_str (member_path.stem().string());
+    package_member.name = scanned.strings.copy
+      (std::string_view (member_path_str).substr (member_path_str.find_first_of ('.') + 1));
+    package_member.include_id = 0;
+    package_member.file_size = 0;
+    package_member.file_mtime = 0;
+    package_member.content_hash = 0;
+    package_member.compacted = false;
+
+    const bool is_lua (member_path.extension() == ".lua");
+    if (member_path.extension() == ".inc")
+    {
+      package_member.include_id =
+        std::stoi (boost::filesystem::read_symlink (member_path).stem().string());
+      stats::count ("include symlinks");
+    }
+    else if (is_lua)
+    {
+      struct stat status;
+      if (::stat (member_path.c_str(), &status) != 0)
+      {
+        throw std::runtime_error ("file not found: " + member_path.string());
+      }
+      package_member.file_size = status.st_size;
+      package_member.file_mtime = int64_t (status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+    }
+    else
+    {
+      continue;
+    }
+
+    package_member.sequence =
+      std::stoi (std::string ( member_path_str.begin()
+                             , member_path_str.begin() + member_path_str.find_first_of ('.')
+                             )
+                );
+    scanned.members.push_back (package_member);
+    if (is_lua)
+    {
+      scanned.lua_members.push_back ({nullptr, member_path, nullptr});
+    }
+  }
+
+  // members are complete, so pointers to them stay valid. the .lua ones
+  // are the ones that are not includes, in the same order.
+  std::size_t lua (0);
+  for (package_member_t& member : scanned.members)
+  {
+    if (!member.include_id)
+    {
+      scanned.lua_members[lua++].member = &member;
+    }
+  }
+
+  scanned.valid = true;
+}
+
+struct tree_input_counts
+{
+  std::size_t scripts;
+  std::size_t reused;
+};
+
+// adds the packages in by_id_dir to database. the directories are
+// scanned and the scripts read jobs at a time. reuse is asked first for
+// every script and may fill in its content from elsewhere, into the
+// member's buffer, returning whether it did.
+template<typename Reuse>
+tree_input_counts read_tree ( const boost::filesystem::path by_id_dir
+                            , SceneScriptDatabase& database
+                            , std::size_t jobs
+                            , Reuse const& reuse
+                            )
+{
+  std::vector<boost::filesystem::path> package_dirs;
+  {
+    const stats::scope timer ("list package directories");
+    for ( boost::filesystem::directory_entry package_dentry
+        : boost::make_iterator_range (boost::filesystem::directory_iterator (by_id_dir), boost::filesystem::directory_iterator())
+        )
+    {
+      package_dirs.push_back (package_dentry.path());
+    }
+  }
+
+  std::vector<scanned_package_t> scanned (package_dirs.size());
+  parallel_for (jobs, package_dirs.size(), [&] (std::size_t i)
+    {
+      scan_package (package_dirs[i], scanned[i]);
+    }
+  );
+
+  std::vector<lua_member_t> lua_members;
+  for (scanned_package_t const& package : scanned)
+  {
+    lua_members.insert (lua_members.end(), package.lua_members.begin(), package.lua_members.end());
+  }
+  for (lua_member_t& lua_member : lua_members)
+  {
+    lua_member.buffer = database.strings().allocate (lua_member.member->file_size);
+  }
+  // for files that changed size since they were scanned
+  std::mutex strings_mutex;
+
+  std::atomic<std::size_t> reused_count (0);
+  std::atomic<std::size_t> bytes_read (0);
+  parallel_for (jobs, lua_members.size(), [&] (std::size_t i)
+    {
+      const stats::scope timer ("read script");
+      if (reuse (lua_members[i]))
+      {
+        ++reused_count;
+        return;
+      }
+      const mapped_file content_raw (lua_members[i].path.string());
+      char* buffer (lua_members[i].buffer);
+      if (content_raw.size() != lua_members[i].member->file_size)
+      {
+        const std::lock_guard<std::mutex> lock (strings_mutex);
+        buffer = database.strings().allocate (content_raw.size());
+      }
+      std::memcpy (buffer, content_raw.data(), content_raw.size());
+      lua_members[i].member->content = {buffer, content_raw.size()};
+      lua_members[i].member->content_hash = fnv1a (lua_members[i].member->content);
+      bytes_read += content_raw.size();
+    }
+  );
+  stats::count ("scripts read", lua_members.size() - reused_count);
+  stats::count ("scripts reused", reused_count);
+  stats::count ("script bytes read", bytes_read);
+
+  // added in directory order, so of duplicate packages or members the
+  // last one found wins, as if scanned serially
+  std::vector<package_t> packages;
+  std::vector<package_member_t> members;
+  for (scanned_package_t& package : scanned)
+  {
+    if (package.valid)
+    {
+      packages.push_back (package.package);
+      members.insert (members.end(), package.members.begin(), package.members.end());
+    }
+    database.strings().adopt (std::move (package.strings));
+  }
+  database.add (packages, members);
+  return {lua_members.size(), reused_count};
+}
+
+inline tree_input_counts read_tree (const boost::filesystem::path by_id_dir, SceneScriptDatabase& database, std::size_t jobs)
+{
+  return read_tree (by_id_dir, database, jobs, [] (lua_member_t const&) { return false; });
+}
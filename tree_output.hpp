@@ -0,0 +1,337 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "include_graph.hpp"
+#include "mapped_file.hpp"
+#include "output_backend.hpp"
+#include "package_view.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+
+// helpers to update an exported tree in place: files and links are only
+// touched if they differ from what they should be, so exporting twice is
+// a no-op and re-exporting after a patch only touches what it changed.
+
+inline bool file_has_content (const boost::filesystem::path filename, content_pieces const& content)
+{
+  const std::size_t size (content_size (content));
+
+  boost::system::error_code ec;
+  if ( !boost::filesystem::is_regular_file (boost::filesystem::symlink_status (filename, ec))
+    || boost::filesystem::file_size (filename, ec) != size
+     )
+  {
+    return false;
+  }
+
+  const mapped_file file (filename.string());
+  std::string_view existing (file.view());
+  for (std::string_view piece : content)
+  {
+    if (existing.substr (0, piece.size()) != piece)
+    {
+      return false;
+    }
+    existing.remove_prefix (piece.size());
+  }
+  return true;
+}
+
+// writes to a temporary file next to filename which is then renamed
+// over it, so readers never see a partially written file.
+inline bool write_file_if_changed (const boost::filesystem::path filename, content_pieces const& content)
+{
+  if (file_has_content (filename, content))
+  {
+    return false;
+  }
+
+  const boost::filesystem::path temporary
+    (filename.parent_path() / ("." + filename.filename().string() + ".tmp"));
+  const int fd (::open (temporary.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+  if (fd < 0)
+  {
+    throw std::runtime_error ("file not opened: " + temporary.string());
+  }
+  try
+  {
+    write_pieces (fd, content);
+  }
+  catch (...)
+  {
+    ::close (fd);
+    boost::filesystem::remove (temporary);
+    throw std::runtime_error ("file not written: " + temporary.string());
+  }
+  if (::close (fd) != 0)
+  {
+    boost::filesystem::remove (temporary);
+    throw std::runtime_error ("file not written: " + temporary.string());
+  }
+  boost::filesystem::rename (temporary, filename);
+  return true;
+}
+
+inline bool write_file_if_changed (const boost::filesystem::path filename, std::string_view content)
+{
+  return write_file_if_changed (filename, content_pieces (1, content));
+}
+
+// removes everything in dir that is not in expected, descending into
+// expected directories, but not into symlinks, up to depth levels.
+inline std::size_t remove_unexpected ( const boost::filesystem::path dir
+                                     , std::unordered_set<std::string> const& expected
+                                     , int depth
+                                     )
+{
+  std::vector<boost::filesystem::path> unexpected;
+  std::size_t removed (0);
+  for ( boost::filesystem::directory_iterator it (dir)
+      ; it != boost::filesystem::directory_iterator()
+      ; ++it
+      )
+  {
+    const boost::filesystem::path path (it->path());
+    if (!expected.count (path.string()))
+    {
+      unexpected.push_back (path);
+    }
+    else if ( depth > 1
+           && boost::filesystem::is_directory (boost::filesystem::symlink_status (path))
+            )
+    {
+      removed += remove_unexpected (path, expected, depth - 1);
+    }
+  }
+  for (boost::filesystem::path const& path : unexpected)
+  {
+    removed += boost::filesystem::remove_all (path);
+  }
+  return removed;
+}
+
+inline std::string replace_not_permitted_characters (std::string str)
+{
+  std::replace (str.begin(), str.end(), '/', ',');
+  return str;
+}
+
+// writes the 'by id' and 'by name' tree into output_dir and reports the
+// number of changes to log. packages are compared with the tree on jobs
+// threads, in groups whose directories stay open until backend has made
+// the changes in them. each package is compared by one task, so that the
+// output does not depend on the number of jobs.
+inline void export_tree ( const boost::filesystem::path output_dir
+                        , std::vector<package_view> const& packages
+                        , std::size_t jobs
+                        , output_backend& backend
+                        , std::ostream& log
+                        )
+{
+  const stats::scope timer ("export tree");
+  const boost::filesystem::path by_name_dir (output_dir / "by name");
+  const boost::filesystem::path by_id_dir (output_dir / "by id");
+
+  boost::filesystem::create_directories (output_dir);
+  boost::filesystem::create_directories (by_name_dir);
+  boost::filesystem::create_directories (by_id_dir);
+  const directory by_name (by_name_dir.string());
+  const directory by_id (by_id_dir.string());
+
+  // with duplicate names, the first package in the table gets the link
+  std::vector<bool> owns_name_link (packages.size(), false);
+  {
+    std::unordered_set<std::string> link_names;
+    for (std::size_t i (0); i < packages.size(); ++i)
+    {
+      const std::string link_name
+        (replace_not_permitted_characters (std::string (packages[i].name)));
+      owns_name_link[i] = link_names.insert (link_name).second;
+      if (!owns_name_link[i])
+      {
+        std::cerr << packages[i].id << ": duplicate name " << link_name << "\n";
+      }
+    }
+  }
+
+  std::size_t written (0);
+  std::atomic<std::size_t> unchanged (0);
+  std::vector<std::vector<std::string>> expected_by_package (packages.size());
+
+  constexpr std::size_t packages_per_group (256);
+  for (std::size_t group (0); group < packages.size(); group += packages_per_group)
+  {
+    const std::size_t group_size (std::min (packages_per_group, packages.size() - group));
+    // what the ops refer to
+    std::vector<std::unique_ptr<directory>> dirs (group_size);
+    std::vector<std::string> ids (group_size);
+    std::vector<std::vector<output_op>> ops_by_package (group_size);
+
+    {
+      const stats::scope check_timer ("compare with tree");
+      parallel_for (jobs, group_size, [&] (std::size_t g)
+        {
+          const std::size_t i (group + g);
+          package_view const& package (packages[i]);
+          std::vector<std::string>& expected (expected_by_package[i]);
+          std::vector<output_op>& ops (ops_by_package[g]);
+
+          std::string const& id (ids[g] = std::to_string (package.id));
+          const boost::filesystem::path dir_path (by_id_dir / id);
+          dirs[g].reset (new directory (by_id, id));
+          expected.push_back (dir_path.string());
+
+          const auto file
+            ( [&] (directory const& dir, std::string name, content_pieces content)
+              {
+                expected.push_back (dir.path() + "/" + name);
+                const file_state state (compare_file (dir, name, content));
+                if (state == file_state::same)
+                {
+                  ++unchanged;
+                  return;
+                }
+                ops.push_back ({&dir, std::move (name), false, std::move (content), state != file_state::missing, {}});
+              }
+            );
+          const auto symlink
+            ( [&] (directory const& dir, std::string name, std::string target)
+              {
+                expected.push_back (dir.path() + "/" + name);
+                const file_state state (compare_symlink (dir, name, target));
+                if (state == file_state::same)
+                {
+                  ++unchanged;
+                  return;
+                }
+                ops.push_back ({&dir, std::move (name), true, {}, state != file_state::missing, std::move (target)});
+              }
+            );
+
+          file (*dirs[g], "name.txt", content_pieces (1, package.name));
+          file (*dirs[g], "id.txt", content_pieces (1, id));
+          if (owns_name_link[i])
+          {
+            symlink (by_name, replace_not_permitted_characters (std::string (package.name)), dir_path.string());
+          }
+
+          for (member_view const& member : package.members)
+          {
+            const std::string name (std::to_string (member.sequence) + "." + std::string (member.name));
+            if (member.include_id == 0)
+            {
+              file (*dirs[g], name + ".lua", member.content);
+            }
+            else
+            {
+              symlink (*dirs[g], name + ".inc", (by_id_dir / std::to_string (member.include_id)).string());
+            }
+          }
+        }
+      );
+    }
+
+    std::vector<output_op> ops;
+    for (std::vector<output_op>& package_ops : ops_by_package)
+    {
+      std::move (package_ops.begin(), package_ops.end(), std::back_inserter (ops));
+    }
+    const stats::scope write_timer (std::string ("write tree with ") + backend.name());
+    backend.run (ops);
+    written += ops.size();
+  }
+
+  // whatever was exported before but is no longer in the tables
+  std::unordered_set<std::string> expected;
+  for (std::vector<std::string> const& package_expected : expected_by_package)
+  {
+    expected.insert (package_expected.begin(), package_expected.end());
+  }
+  const std::size_t removed
+    ( remove_unexpected (by_name_dir, expected, 1)
+    + remove_unexpected (by_id_dir, expected, 2)
+    );
+
+  stats::count ("tree entries written", written);
+  stats::count ("tree entries unchanged", unchanged);
+  stats::count ("tree entries removed", removed);
+  log << output_dir.string() << ": " << written << " written, " << unchanged
+      << " unchanged, " << removed << " removed\n";
+}
+
+// writes every package with its includes expanded to
+// output_dir/<id>.lua, for reading a scene script the way the client
+// runs it. packages in or including an include cycle are left out,
+// includes of unknown packages are skipped, both with a warning.
+inline void export_flattened ( const boost::filesystem::path output_dir
+                             , std::vector<package_view> const& packages
+                             , output_backend& backend
+                             , std::ostream& log
+                             )
+{
+  const stats::scope timer ("export flattened");
+
+  include_graph graph (packages);
+  for (auto const& missing : graph.missing())
+  {
+    std::cerr << packages[missing.first].id << ": includes unknown package " << missing.second << "\n";
+  }
+  for (std::vector<std::size_t> const& cycle : graph.cycles())
+  {
+    std::cerr << "include cycle:";
+    for (std::size_t package : cycle)
+    {
+      std::cerr << " " << packages[package].id << " ->";
+    }
+    std::cerr << " " << packages[cycle.front()].id << "\n";
+  }
+
+  boost::filesystem::create_directories (output_dir);
+  const directory dir (output_dir.string());
+
+  std::unordered_set<std::string> expected;
+  std::vector<output_op> ops;
+  std::size_t unchanged (0);
+  for (std::size_t package : graph.order())
+  {
+    std::string name (std::to_string (packages[package].id) + ".lua");
+    content_pieces const& content (graph.flattened (package));
+    expected.insert (dir.path() + "/" + name);
+    const file_state state (compare_file (dir, name, content));
+    if (state == file_state::same)
+    {
+      ++unchanged;
+      continue;
+    }
+    ops.push_back ({&dir, std::move (name), false, content, state != file_state::missing, {}});
+  }
+  {
+    const stats::scope write_timer (std::string ("write flattened with ") + backend.name());
+    backend.run (ops);
+  }
+  const std::size_t removed (remove_unexpected (output_dir, expected, 1));
+
+  stats::count ("flattened packages", graph.order().size());
+  stats::count ("include cycles", graph.cycles().size());
+  log << output_dir.string() << ": " << ops.size() << " written, " << unchanged
+      << " unchanged, " << removed << " removed\n";
+}
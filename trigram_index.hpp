@@ -0,0 +1,643 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <ostream>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "package_view.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "tree_output.hpp"
+
+// a search index over package names and scripts, to be mapped and used
+// in place like an archive:
+//   trigram_index_header
+//   trigram_document[document_count], by package id and sequence
+//   trigram_entry[trigram_count], sorted by trigram
+//   uint32_t postings[posting_count]: per trigram the documents holding
+//     it, ascending
+//   data: names and contents, each distinct content once
+// trigrams are of ASCII-lowercased text, so that the same index serves
+// case-sensitive and case-insensitive searches. the documents are
+// searched as a whole for candidates, which are then verified.
+struct trigram_index_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t document_count;
+  uint32_t trigram_count;
+  uint64_t posting_count;
+  uint64_t data_size;
+};
+static_assert (sizeof (trigram_index_header) == 0x20, "size of trigram_index_header");
+
+// a package, whose content is its name, or a script
+struct trigram_document
+{
+  int32_t package;
+  int32_t sequence;
+  uint32_t is_script;
+  uint32_t name_size;
+  uint64_t name_offset;
+  uint64_t content_offset;
+  uint64_t content_size;
+};
+static_assert (sizeof (trigram_document) == 0x28, "size of trigram_document");
+
+struct trigram_entry
+{
+  uint32_t trigram;
+  uint32_t posting_count;
+  uint64_t first_posting;
+};
+static_assert (sizeof (trigram_entry) == 0x10, "size of trigram_entry");
+
+constexpr uint32_t const trigram_index_magic = 0x49545353; // 'SSTI'
+constexpr uint32_t const trigram_index_version = 1;
+
+// ASCII lowercase of every byte
+inline std::array<unsigned char, 256> const& lowercase_table()
+{
+  static const std::array<unsigned char, 256> table
+    ( []
+      {
+        std::array<unsigned char, 256> lower;
+        for (int c (0); c < 256; ++c)
+        {
+          lower[c] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        }
+        return lower;
+      }()
+    );
+  return table;
+}
+
+// the distinct trigrams of text in order of appearance, each as three
+// lowercased bytes
+inline std::vector<uint32_t> trigrams (std::string_view text)
+{
+  std::array<unsigned char, 256> const& lower (lowercase_table());
+  // a bit per possible trigram, so that only distinct ones are sorted.
+  // cleared again before returning.
+  thread_local std::vector<uint64_t> seen (std::size_t (1) << 18);
+  std::vector<uint32_t> found;
+  uint32_t trigram (0);
+  for (std::size_t i (0); i < text.size(); ++i)
+  {
+    trigram = (trigram << 8 | lower[static_cast<unsigned char> (text[i])]) & 0xffffff;
+    uint64_t& word (seen[trigram >> 6]);
+    const uint64_t bit (uint64_t (1) << (trigram & 63));
+    if (i >= 2 && !(word & bit))
+    {
+      word |= bit;
+      found.push_back (trigram);
+    }
+  }
+  for (uint32_t distinct : found)
+  {
+    seen[distinct >> 6] = 0;
+  }
+  return found;
+}
+
+// returns whether the file changed
+inline bool write_trigram_index ( const boost::filesystem::path filename
+                                , std::vector<package_view> packages
+                                , std::size_t jobs
+                                )
+{
+  const stats::scope timer ("write trigram index");
+  std::sort ( packages.begin(), packages.end()
+            , [] (package_view const& lhs, package_view const& rhs) { return lhs.id < rhs.id; }
+            );
+
+  // scripts are searched whole, so their pieces are joined. a content
+  // found in many packages is joined and stored once.
+  arena contents;
+  std::unordered_map<std::string_view, uint64_t> content_offsets;
+  std::vector<trigram_document> documents;
+  std::vector<std::string_view> document_contents;
+  content_pieces data;
+  uint64_t data_size (0);
+  const auto append
+    ( [&] (std::string_view piece)
+      {
+        data.push_back (piece);
+        data_size += piece.size();
+        return data_size - piece.size();
+      }
+    );
+
+  for (package_view& package : packages)
+  {
+    std::stable_sort ( package.members.begin(), package.members.end()
+                     , [] (member_view const& lhs, member_view const& rhs) { return lhs.sequence < rhs.sequence; }
+                     );
+
+    trigram_document document;
+    document.package = package.id;
+    document.sequence = 0;
+    document.is_script = 0;
+    document.name_size = package.name.size();
+    document.name_offset = append (package.name);
+    document.content_offset = document.name_offset;
+    document.content_size = package.name.size();
+    documents.push_back (document);
+    document_contents.push_back (package.name);
+
+    for (member_view const& member : package.members)
+    {
+      if (member.include_id != 0)
+      {
+        continue;
+      }
+      std::size_t size (0);
+      for (std::string_view piece : member.content)
+      {
+        size += piece.size();
+      }
+      char* joined (contents.allocate (size));
+      std::size_t offset (0);
+      for (std::string_view piece : member.content)
+      {
+        std::memcpy (joined + offset, piece.data(), piece.size());
+        offset += piece.size();
+      }
+      const std::string_view content (joined, size);
+
+      document.sequence = member.sequence;
+      document.is_script = 1;
+      document.name_size = member.name.size();
+      document.name_offset = append (member.name);
+      const auto stored (content_offsets.emplace (content, data_size));
+      if (stored.second)
+      {
+        append (content);
+      }
+      document.content_offset = stored.first->second;
+      document.content_size = size;
+      documents.push_back (document);
+      document_contents.push_back (content);
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> document_trigrams (documents.size());
+  {
+    const stats::scope trigrams_timer ("extract trigrams");
+    parallel_for (jobs, documents.size(), [&] (std::size_t d)
+      {
+        document_trigrams[d] = trigrams (document_contents[d]);
+      }
+    );
+  }
+
+  // (trigram, document) sorted, i.e. the posting lists one after another
+  const stats::scope sort_timer ("sort postings");
+  std::vector<uint64_t> pairs;
+  {
+    std::size_t count (0);
+    for (std::vector<uint32_t> const& found : document_trigrams)
+    {
+      count += found.size();
+    }
+    pairs.reserve (count);
+  }
+  for (std::size_t d (0); d < documents.size(); ++d)
+  {
+    for (uint32_t trigram : document_trigrams[d])
+    {
+      pairs.push_back (uint64_t (trigram) << 32 | d);
+    }
+    std::vector<uint32_t>().swap (document_trigrams[d]);
+  }
+  // the documents are in order already, so a stable sort by trigram
+  // suffices: one counting pass per byte of it
+  {
+    std::vector<uint64_t> sorted (pairs.size());
+    for (int shift (32); shift < 56; shift += 8)
+    {
+      std::size_t starts[257] = {};
+      for (uint64_t pair : pairs)
+      {
+        ++starts[(pair >> shift & 0xff) + 1];
+      }
+      for (std::size_t b (1); b < 257; ++b)
+      {
+        starts[b] += starts[b - 1];
+      }
+      for (uint64_t pair : pairs)
+      {
+        sorted[starts[pair >> shift & 0xff]++] = pair;
+      }
+      pairs.swap (sorted);
+    }
+  }
+
+  std::vector<trigram_entry> entries;
+  std::vector<uint32_t> postings (pairs.size());
+  for (std::size_t p (0); p < pairs.size(); ++p)
+  {
+    const uint32_t trigram (pairs[p] >> 32);
+    if (entries.empty() || entries.back().trigram != trigram)
+    {
+      entries.push_back ({trigram, 0, p});
+    }
+    ++entries.back().posting_count;
+    postings[p] = uint32_t (pairs[p]);
+  }
+
+  trigram_index_header header;
+  header.magic = trigram_index_magic;
+  header.version = trigram_index_version;
+  header.document_count = documents.size();
+  header.trigram_count = entries.size();
+  header.posting_count = postings.size();
+  header.data_size = data_size;
+
+  stats::count ("indexed documents", documents.size());
+  stats::count ("indexed trigrams", entries.size());
+  stats::count ("index postings", postings.size());
+
+  content_pieces content;
+  content.reserve (data.size() + 4);
+  content.emplace_back (reinterpret_cast<const char*> (&header), sizeof (header));
+  content.emplace_back ( reinterpret_cast<const char*> (documents.data())
+                       , documents.size() * sizeof (trigram_document)
+                       );
+  content.emplace_back ( reinterpret_cast<const char*> (entries.data())
+                       , entries.size() * sizeof (trigram_entry)
+                       );
+  content.emplace_back ( reinterpret_cast<const char*> (postings.data())
+                       , postings.size() * sizeof (uint32_t)
+                       );
+  content.insert (content.end(), data.begin(), data.end());
+  return write_file_if_changed (filename, content);
+}
+
+// an index in memory, usually a mapped_file, used in place
+class trigram_index
+{
+public:
+  trigram_index (const char* file, std::size_t size)
+  {
+    if (size < sizeof (trigram_index_header)) throw std::invalid_argument ("index too small");
+    trigram_index_header header;
+    std::memcpy (&header, file, sizeof (header));
+    if (header.magic != trigram_index_magic) throw std::invalid_argument ("bad index header");
+    if (header.version != trigram_index_version) throw std::invalid_argument ("unknown index version");
+
+    const uint64_t entries_offset
+      (sizeof (trigram_index_header) + uint64_t (header.document_count) * sizeof (trigram_document));
+    const uint64_t postings_offset
+      (entries_offset + uint64_t (header.trigram_count) * sizeof (trigram_entry));
+    // the 32 bit counts cannot make the offsets wrap, the 64 bit ones
+    // can, so they are checked against what is left instead
+    if ( postings_offset > size
+      || header.posting_count > (size - postings_offset) / sizeof (uint32_t)
+       )
+    {
+      throw std::invalid_argument ("index size mismatch");
+    }
+    const uint64_t data_offset
+      (postings_offset + header.posting_count * sizeof (uint32_t));
+    if (header.data_size != size - data_offset) throw std::invalid_argument ("index size mismatch");
+
+    _documents = reinterpret_cast<const trigram_document*> (file + sizeof (trigram_index_header));
+    _document_count = header.document_count;
+    _entries = reinterpret_cast<const trigram_entry*> (file + entries_offset);
+    _trigram_count = header.trigram_count;
+    _postings = reinterpret_cast<const uint32_t*> (file + postings_offset);
+    _posting_count = header.posting_count;
+    _data = std::string_view (file + data_offset, header.data_size);
+
+    // as above, first_posting is 64 bit, so the end of its list is not
+    // computed but compared with what is left
+    for (std::size_t t (0); t < _trigram_count; ++t)
+    {
+      if ( _entries[t].first_posting > _posting_count
+        || _entries[t].posting_count > _posting_count - _entries[t].first_posting
+         )
+      {
+        throw std::invalid_argument ("index posting out of bounds");
+      }
+    }
+  }
+
+  std::size_t size() const
+  {
+    return _document_count;
+  }
+  trigram_document const& document (std::size_t d) const
+  {
+    return _documents[d];
+  }
+  std::string_view name (std::size_t d) const
+  {
+    return string (_documents[d].name_offset, _documents[d].name_size);
+  }
+  std::string_view content (std::size_t d) const
+  {
+    return string (_documents[d].content_offset, _documents[d].content_size);
+  }
+
+  // the documents that hold all trigrams of all literals, ascending.
+  // without any trigram, i.e. literals shorter than three, that is all.
+  std::vector<uint32_t> candidates (std::vector<std::string> const& literals) const
+  {
+    std::vector<uint32_t> required;
+    for (std::string const& literal : literals)
+    {
+      const std::vector<uint32_t> literal_trigrams (trigrams (literal));
+      required.insert (required.end(), literal_trigrams.begin(), literal_trigrams.end());
+    }
+
+    std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+    for (uint32_t trigram : required)
+    {
+      const trigram_entry* const entry
+        ( std::lower_bound ( _entries, _entries + _trigram_count, trigram
+                           , [] (trigram_entry const& lhs, uint32_t rhs) { return lhs.trigram < rhs; }
+                           )
+        );
+      if (entry == _entries + _trigram_count || entry->trigram != trigram)
+      {
+        return {};
+      }
+      lists.emplace_back (_postings + entry->first_posting, _postings + entry->first_posting + entry->posting_count);
+    }
+
+    std::vector<uint32_t> result;
+    if (lists.empty())
+    {
+      result.resize (_document_count);
+      for (std::size_t d (0); d < _document_count; ++d)
+      {
+        result[d] = d;
+      }
+      return result;
+    }
+
+    // shortest first, so that the intermediate results stay small
+    std::sort ( lists.begin(), lists.end()
+              , [] (auto const& lhs, auto const& rhs) { return lhs.second - lhs.first < rhs.second - rhs.first; }
+              );
+    result.assign (lists.front().first, lists.front().second);
+    for (std::size_t l (1); l < lists.size() && !result.empty(); ++l)
+    {
+      std::vector<uint32_t> both;
+      std::set_intersection ( result.begin(), result.end(), lists[l].first, lists[l].second
+                            , std::back_inserter (both)
+                            );
+      result.swap (both);
+    }
+    // postings are only checked when used, so that opening an index
+    // does not read all of them
+    if (!result.empty() && result.back() >= _document_count)
+    {
+      throw std::invalid_argument ("index document out of bounds");
+    }
+    return result;
+  }
+
+private:
+  std::string_view string (uint64_t offset, uint64_t size) const
+  {
+    if (offset > _data.size() || size > _data.size() - offset)
+    {
+      throw std::invalid_argument ("index offset out of bounds");
+    }
+    return _data.substr (offset, size);
+  }
+
+  const trigram_document* _documents;
+  std::size_t _document_count;
+  const trigram_entry* _entries;
+  std::size_t _trigram_count;
+  const uint32_t* _postings;
+  std::size_t _posting_count;
+  std::string_view _data;
+};
+
+// the literal runs every match of the ECMAScript regex contains, for
+// narrowing the candidates. groups, classes, escapes other than of
+// punctuation, and optional characters end a run. with an alternation
+// outside groups, no run is certain.
+inline std::vector<std::string> required_literals (std::string_view regex)
+{
+  std::vector<std::string> literals;
+  std::string run;
+  const auto end_run
+    ( [&]
+      {
+        if (run.size() >= 3)
+        {
+          literals.push_back (run);
+        }
+        run.clear();
+      }
+    );
+  // the end of the class starting at regex[i]
+  const auto class_end
+    ( [&] (std::size_t i)
+      {
+        std::size_t end (i + 1);
+        if (end < regex.size() && regex[end] == '^') ++end;
+        if (end < regex.size() && regex[end] == ']') ++end;
+        while (end < regex.size() && regex[end] != ']')
+        {
+          end += regex[end] == '\\' ? 2 : 1;
+        }
+        return std::min (end + 1, regex.size());
+      }
+    );
+  // the end of the quantifier at regex[i], or i if there is none
+  const auto quantifier_end
+    ( [&] (std::size_t i)
+      {
+        std::size_t end (i);
+        if (end < regex.size() && std::strchr ("*+?", regex[end]))
+        {
+          ++end;
+        }
+        else if (end < regex.size() && regex[end] == '{')
+        {
+          end = std::min (regex.find ('}', end), regex.size() - 1) + 1;
+        }
+        if (end != i && end < regex.size() && regex[end] == '?')
+        {
+          ++end;
+        }
+        return end;
+      }
+    );
+
+  int depth (0);
+  std::size_t i (0);
+  while (i < regex.size())
+  {
+    const char c (regex[i]);
+    char literal;
+    if (c == '\\' && i + 1 < regex.size() && !std::isalnum (static_cast<unsigned char> (regex[i + 1])))
+    {
+      literal = regex[i + 1];
+      i += 2;
+    }
+    else if (c == '\\')
+    {
+      i += 2;
+      end_run();
+      continue;
+    }
+    else if (c == '[')
+    {
+      i = class_end (i);
+      end_run();
+      continue;
+    }
+    else if (c == '(' || c == ')')
+    {
+      depth += c == '(' ? 1 : -1;
+      i = c == ')' ? quantifier_end (i + 1) : i + 1;
+      end_run();
+      continue;
+    }
+    else if (c == '|')
+    {
+      if (depth == 0)
+      {
+        return {};
+      }
+      ++i;
+      continue;
+    }
+    else if (std::strchr (".^$*+?{", c))
+    {
+      i = c == '.' || c == '^' || c == '$' ? quantifier_end (i + 1) : quantifier_end (i);
+      end_run();
+      continue;
+    }
+    else
+    {
+      literal = c;
+      ++i;
+    }
+
+    if (depth > 0)
+    {
+      continue;
+    }
+    const std::size_t after (quantifier_end (i));
+    if (after == i)
+    {
+      run += literal;
+    }
+    else if (regex[i] == '+')
+    {
+      // at least once: the run ends with it, and the next starts after
+      run += literal;
+      end_run();
+    }
+    else
+    {
+      end_run();
+    }
+    i = after;
+  }
+  end_run();
+  return literals;
+}
+
+// prints what matches pattern, a substring or an ECMAScript regex, like
+// grep would in the 'by id' tree: script lines as
+// <package>/<sequence>.<name>.lua:<line>: <text> and package names as
+// <package>/name.txt: <name>. returns the number of matches.
+inline std::size_t query_index ( trigram_index const& index
+                               , std::string const& pattern
+                               , bool regex
+                               , bool ignore_case
+                               , std::ostream& out
+                               )
+{
+  const stats::scope timer ("query");
+  const std::vector<uint32_t> candidates
+    (index.candidates (regex ? required_literals (pattern) : std::vector<std::string> (1, pattern)));
+  stats::count ("candidates", candidates.size());
+
+  const auto lowercase
+    ( [] (std::string_view text, std::string& lowered)
+      {
+        lowered.resize (text.size());
+        std::transform ( text.begin(), text.end(), lowered.begin()
+                       , [] (unsigned char c) { return char (lowercase_table()[c]); }
+                       );
+      }
+    );
+  std::regex compiled;
+  if (regex)
+  {
+    compiled.assign
+      (pattern, ignore_case ? std::regex::ECMAScript | std::regex::icase : std::regex::ECMAScript);
+  }
+  std::string lowered_pattern;
+  lowercase (pattern, lowered_pattern);
+  std::string lowered_line;
+  const auto matches
+    ( [&] (std::string_view line)
+      {
+        if (regex)
+        {
+          return std::regex_search (line.begin(), line.end(), compiled);
+        }
+        if (ignore_case)
+        {
+          lowercase (line, lowered_line);
+          return lowered_line.find (lowered_pattern) != std::string::npos;
+        }
+        return line.find (pattern) != std::string_view::npos;
+      }
+    );
+
+  std::size_t found (0);
+  for (uint32_t d : candidates)
+  {
+    trigram_document const& document (index.document (d));
+    std::string_view content (index.content (d));
+    if (!document.is_script)
+    {
+      if (matches (content))
+      {
+        ++found;
+        out << document.package << "/name.txt: " << content << "\n";
+      }
+      continue;
+    }
+    for (std::size_t line_number (1); !content.empty(); ++line_number)
+    {
+      const std::size_t line_end (std::min (content.find ('\n'), content.size()));
+      const std::string_view line (content.substr (0, line_end));
+      if (matches (line))
+      {
+        ++found;
+        out << document.package << "/" << document.sequence << "." << index.name (d) << ".lua:"
+            << line_number << ": " << line << "\n";
+      }
+      content.remove_prefix (std::min (line_end + 1, content.size()));
+    }
+  }
+  stats::count ("matches", found);
+  return found;
+}
@@ -1,146 +1,98 @@
 #include <boost/filesystem.hpp>
-#include <boost/range/iterator_range.hpp>
 
-#include <algorithm>
-#include <cstdio>
-#include <fstream>
+#include <cstring>
 #include <iostream>
-#include <map>
-#include <stdexcept>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "allocation_counter.hpp"
+#include "archive.hpp"
+#include "chunking.hpp"
+#include "db2.hpp"
+#include "hash.hpp"
+#include "id_index.hpp"
+#include "manifest.hpp"
+#include "mapped_file.hpp"
+#include "scene_script_database.hpp"
+#include "stats.hpp"
 #include "structures.hpp"
+#include "tree_input.hpp"
 
-std::vector<char> read_file (const std::string filename)
+int main (int argc, char** argv)
 {
-  std::vector<char> buffer;
-  if (FILE* fp = fopen (filename.c_str(), "r"))
+  std::size_t jobs (1);
+  bool incremental (false);
+  bool common_data (false);
+  chunk_options chunking;
+#ifdef NDEBUG
+  chunking.compact = true;
+#endif
+  std::string from_archive;
+  std::string to_archive;
+  bool print_stats (false);
+  std::string trace_filename;
+  for (int i (1); i < argc; ++i)
   {
-    char buf[1024];
-    while (size_t len = fread (buf, 1, sizeof(buf), fp))
+    const std::string arg (argv[i]);
+    if ((arg == "--jobs" || arg == "-j") && i + 1 < argc)
     {
-      buffer.insert (buffer.end(), buf, buf + len);
+      jobs = std::stoul (argv[++i]);
     }
-    fclose (fp);
-  }
-  else
-  {
-    throw std::runtime_error ("file not opened: " + filename);
-  }
-  return buffer;
-}
-void write_file (const boost::filesystem::path filename, std::vector<char> data)
-{
-  if (FILE* fp = fopen (filename.string().c_str(), "w"))
-  {
-    fwrite (data.data(), data.size(), 1, fp);
-    fclose (fp);
-  }
-  else
-  {
-    throw std::runtime_error ("file not opened: " + filename.string());
-  }
-}
-
-template<typename Raw, typename Rec>
-std::vector<char> put_records (std::vector<Rec> const& recs)
-{
-  std::vector<char> data (sizeof (DB2Header) + sizeof (Raw) * recs.size());
-  uint32_t filesize (0);
-
-  {
-    DB2Header* header (reinterpret_cast<DB2Header*> (data.data()));
-
-    header->magic = '6BDW';
-    header->record_count = recs.size();
-    header->field_count = Raw::field_count - 1;
-    static_assert (sizeof (Rec) % 4 == 0, "assume all-4byte-fields");
-    header->record_size = sizeof (Raw);
-    header->table_hash = Raw::table_hash;
-    header->layout_hash = Raw::layout_hash;
-
-    header->min_id = 0x7fffffff;
-    header->max_id = 0;
-    for (auto const& rec : recs)
+    else if (arg == "--incremental")
     {
-      header->min_id = std::min<uint32_t> (header->min_id, rec.id);
-      header->max_id = std::max<uint32_t> (header->max_id, rec.id);
+      incremental = true;
+    }
+    else if (arg == "--common-data")
+    {
+      common_data = true;
+    }
+    else if (arg == "--chunk-size" && i + 1 < argc)
+    {
+      chunking.max_size = std::stoul (argv[++i]);
+    }
+    else if (arg == "--compact")
+    {
+      chunking.compact = true;
+    }
+    else if (arg == "--no-compact")
+    {
+      chunking.compact = false;
+    }
+    else if (arg == "--from-archive" && i + 1 < argc)
+    {
+      from_archive = argv[++i];
+    }
+    else if (arg == "--to-archive" && i + 1 < argc)
+    {
+      to_archive = argv[++i];
+    }
+    else if (arg == "--stats")
+    {
+      print_stats = true;
+    }
+    else if (arg.compare (0, 8, "--trace=") == 0)
+    {
+      trace_filename = arg.substr (8);
+    }
+    else
+    {
+      std::cerr << "usage: " << argv[0] << " [--jobs N] [--incremental] [--common-data] [--chunk-size N] [--compact|--no-compact] [--from-archive FILE] [--to-archive FILE] [--stats] [--trace=FILE]\n";
+      return 1;
     }
-
-    header->locale = -1;
-    header->copy_table_size = 0;
-    header->flags = 4;
-    header->id_index = 0;
-    header->total_field_count = header->field_count;
-    header->common_data_table_size = 0;
-  }
-  filesize += sizeof (DB2Header);
-
-  data.resize (data.size() + sizeof (uint32_t) * (Raw::field_count - 1));
-  std::copy ( (char const*)Raw::field_layout.data(), (char const*) (Raw::field_layout.data() + Raw::field_layout.size())
-            , data.data() + filesize
-            );
-  filesize += (sizeof (uint32_t) * (Raw::field_count - 1));
-
-  std::vector<Raw> raws;
-  std::vector<uint32_t> ids;
-  std::vector<char> stringblock;
-  stringblock.emplace_back (0); stringblock.emplace_back (0);
-  for (auto const& rec : recs)
-  {
-    uint32_t id (rec.id);
-    raws.emplace_back (rec.raw (stringblock));
-    ids.emplace_back (id);
   }
-  std::copy ( (char*)raws.data(), (char*) (raws.data() + raws.size())
-            , data.data() + filesize
-            );
-  filesize += raws.size() * sizeof (Raw);
 
-  data.insert (data.end(), stringblock.begin(), stringblock.end());
+  check_chunk_options (chunking);
+  if (print_stats || !trace_filename.empty())
   {
-    DB2Header* header (reinterpret_cast<DB2Header*> (data.data()));
-    header->string_table_size = stringblock.size();
+    stats::enable();
   }
-  filesize += stringblock.size();
-
-  data.resize (data.size() + ids.size() * 4);
-  std::copy ( (char*)ids.data(), (char*) (ids.data() + ids.size())
-            , data.data() + filesize
-            );
 
-
-  return data;
-}
-
-std::string replace_not_permitted_characters (std::string str)
-{
-  std::replace (str.begin(), str.end(), '/', ',');
-  return str;
-}
-
-struct package_member_t
-{
-  std::string name;
-  std::string content;
-  int include_id;
-};
-
-struct package_t
-{
-  std::string name;
-  std::map<int, package_member_t> members;
-};
-
-int main (int argc, char** argv)
-{
-  const std::string scene_script_filename
-    ("DBFilesClient_out/SceneScript.db2");
-  const std::string scene_script_package_filename
-    ("DBFilesClient_out/SceneScriptPackage.db2");
-  const std::string scene_script_package_member_filename
-    ("DBFilesClient_out/SceneScriptPackageMember.db2");
+  const std::string db2_dir
+    ("DBFilesClient_out");
+  const std::string manifest_filename
+    ("DBFilesClient_out/scene_scripts.manifest");
 
   const boost::filesystem::path input_dir (boost::filesystem::current_path() / "scene_scripts");
   const boost::filesystem::path output_dir (boost::filesystem::current_path());//("/Applications/World of Warcraft Public Test");
@@ -149,133 +101,121 @@ int main (int argc, char** argv)
   boost::filesystem::create_directories (output_dir / "DBFilesClient");
   // boost::filesystem::create_directories (by_name_dir);
 
-  std::map<int, package_t> packages;
-  std::map<int, int> packages_raw;
+  SceneScriptDatabase database;
+  database.chunking() = chunking;
 
-  for ( boost::filesystem::directory_entry package_dentry
-      : boost::make_iterator_range (boost::filesystem::directory_iterator (by_id_dir), boost::filesystem::directory_iterator())
-      )
+  // ids are kept stable across runs, so an edit does not renumber all
+  // rows that follow it. new rows get ids above any ever used.
+  if (incremental)
   {
-    const boost::filesystem::path package_dir (package_dentry.path());
+    const stats::scope timer ("read manifest");
+    database.ids() = read_manifest (output_dir / manifest_filename);
+  }
+  manifest_t const& manifest (database.ids());
 
-    if (package_dir.stem().string().empty())
+  if (!from_archive.empty())
+  {
+    const stats::scope timer ("read archive");
+    const mapped_file archive (from_archive);
+    database.add (read_archive (archive.data(), archive.size()));
+  }
+  else
+  {
+    // members whose file did not change since the last run are taken
+    // from the previous SceneScript.db2 instead of being read again.
+    // the views point into the mapping, which is kept until then.
+    std::unique_ptr<mapped_file> previous_scene_script_file;
+    std::vector<SceneScriptRecView> previous_script_recs;
+    const boost::filesystem::path previous_scene_script_filename
+      (output_dir / db2_dir / SceneScriptDatabase::scene_script_filename);
+    if (incremental && !manifest.empty() && boost::filesystem::exists (previous_scene_script_filename))
     {
-      continue;
+      const stats::scope timer ("decode previous SceneScript.db2");
+      previous_scene_script_file.reset (new mapped_file (previous_scene_script_filename.string()));
+      previous_script_recs = get_views
+        ( DB2View<SceneScriptRecRaw> ( previous_scene_script_file->data()
+                                     , previous_scene_script_file->size()
+                                     )
+        );
     }
+    const id_index previous_script_recs_by_id (previous_script_recs);
 
-    std::ifstream package_name_stream ((package_dir / "name.txt").string());
-    std::string package_name;
-    std::getline (package_name_stream, package_name);
-
-    package_t package;
-    package.name = package_name;
+    const auto reuse_previous_content
+      ( [&] (lua_member_t const& lua_member)
+        {
+          manifest_entry_t const* const entry
+            (find_manifest_entry (manifest, lua_member.member->package, lua_member.member->sequence));
+          if ( !entry
+            || entry->name != lua_member.member->name
+            || entry->size != lua_member.member->file_size
+            || entry->mtime != lua_member.member->file_mtime
+             )
+          {
+            return false;
+          }
+
+          std::size_t size (0);
+          for (int script_id : entry->script_ids)
+          {
+            const std::size_t row (previous_script_recs_by_id.find (script_id));
+            if ( row == id_index::npos
+              || previous_script_recs[row].name != lua_member.member->name
+              || previous_script_recs[row].content.size() > lua_member.member->file_size - size
+               )
+            {
+              return false;
+            }
+            std::string_view const& part (previous_script_recs[row].content);
+            std::memcpy (lua_member.buffer + size, part.data(), part.size());
+            size += part.size();
+          }
+          // the rows hold what was saved, which is the file compacted if
+          // its hashes differ. that is only of use when compacting again.
+          const bool compacted (entry->saved_hash != entry->hash);
+          if ( size != entry->saved_size
+            || fnv1a ({lua_member.buffer, size}) != entry->saved_hash
+            || (compacted && !chunking.compact)
+             )
+          {
+            return false;
+          }
+
+          lua_member.member->content = {lua_member.buffer, size};
+          lua_member.member->content_hash = entry->hash;
+          lua_member.member->compacted = compacted;
+          return true;
+        }
+      );
 
-    for ( boost::filesystem::directory_entry member_dentry
-        : boost::make_iterator_range (boost::filesystem::directory_iterator (package_dir), boost::filesystem::directory_iterator())
-        )
+    const tree_input_counts counts (read_tree (by_id_dir, database, jobs, reuse_previous_content));
+    if (incremental)
     {
-      const boost::filesystem::path member_path (member_dentry.path());
-
-      if (member_path.stem().string().empty())
-      {
-        continue;
-      }
-
-      package_member_t package_member;
-      const std::string member_path_str (member_path.stem().string());
-      package_member.name = { member_path_str.begin() + member_path_str.find_first_of ('.') + 1
-                            , member_path_str.end()
-                            };
-      package_member.include_id = 0;
-
-      if (member_path.extension() == ".inc")
-      {
-        package_member.include_id =
-          std::stoi (boost::filesystem::read_symlink (member_path).stem().string());
-      }
-      else if (member_path.extension() == ".lua")
-      {
-        const std::vector<char> content_raw (read_file (member_path.string()));
-        package_member.content = {content_raw.begin(), content_raw.end()};
-      }
-      else
-      {
-        continue;
-      }
-
-      package.members.emplace
-        ( std::stoi (std::string ( member_path_str.begin()
-                                 , member_path_str.begin() + member_path_str.find_first_of ('.')
-                                 )
-                    )
-        , package_member
-        );
+      std::cout << manifest_filename << ": " << counts.reused << " of " << counts.scripts
+                << " scripts unchanged\n";
     }
-
-    packages.emplace (std::stoi (package_dir.stem().string()), package);
   }
 
-  std::vector<SceneScriptPackageRec> package_recs;
-  std::vector<SceneScriptPackageMemberRec> package_member_recs;
-  std::vector<SceneScriptRec> script_recs;
-
-  int package_member_id (1);
-  int script_id (1);
-
-  for (std::pair<int, package_t> package : packages)
+  if (!to_archive.empty())
   {
-    SceneScriptPackageRec package_rec;
-    package_rec.id = package.first;
-    package_rec.name = package.second.name;
-
-    for (std::pair<int, package_member_t> member : package.second.members)
-    {
-      SceneScriptPackageMemberRec package_member_rec;
-      package_member_rec.id = package_member_id;
-      package_member_rec.package = package_rec.id;
-      package_member_rec.script = 0;
-      package_member_rec.sequence = member.first;
-      package_member_rec.d = member.second.include_id;
-
-      if (!member.second.include_id)
-      {
-        package_member_rec.script = script_id;
-        constexpr int per_content_part (4000);
-        const int content_parts
-          (std::max (1UL, (member.second.content.size() + per_content_part - 1) / per_content_part));
-
-        for (int content_part (0); content_part < content_parts; ++content_part)
-        {
-          const std::string part_of_content
-            (member.second.content.substr (content_part * per_content_part, per_content_part));
-
-          SceneScriptRec script_rec;
-          script_rec.id = script_id;
-          script_rec.name = member.second.name;
-          script_rec.content = part_of_content;
-          script_rec.previous_script = content_part != 0 ? script_id - 1 : 0;
-          script_rec.next_script = content_part != (content_parts - 1) ? script_id + 1 : 0;
-          ++script_id;
-
-          script_recs.push_back (script_rec);
-        }
-      }
-
-      ++package_member_id;
-      package_member_recs.push_back (package_member_rec);
-    }
-    package_recs.push_back (package_rec);
+    const stats::scope timer ("write archive");
+    const bool changed (write_archive (to_archive, database.views()));
+    std::cout << to_archive << ": " << (changed ? "written" : "unchanged") << "\n";
+  }
+  else
+  {
+    database.save (output_dir / db2_dir, std::cout, common_data);
+    const stats::scope timer ("write manifest");
+    write_manifest (output_dir / manifest_filename, database.ids());
   }
 
-  write_file ( output_dir / scene_script_filename
-             , put_records<SceneScriptRecRaw> (script_recs)
-             );
-  write_file ( output_dir / scene_script_package_filename
-             , put_records<SceneScriptPackageRecRaw> (package_recs)
-             );
-  write_file ( output_dir / scene_script_package_member_filename
-             , put_records<SceneScriptPackageMemberRecRaw> (package_member_recs)
-             );
+  if (print_stats)
+  {
+    stats::report (std::cout);
+  }
+  if (!trace_filename.empty())
+  {
+    stats::write_chrome_trace (trace_filename);
+  }
 
   return 0;
 }